@@ -0,0 +1,914 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "pumps.h"
+
+#include "common/ipc/channel.h"
+#include "common/io/file.h"
+#include "common/io/dir.h"
+#include "common/io/seen.h"
+#include "common/io/exec.h"
+#include "common/lib/bloom/bloom.h"
+#include "common/lib/bloom/hashes.h"
+
+#include "common/error.h"
+#include "common/textutils.h"
+#include "common/configfiles.h"
+#include "common/stats.h"
+
+
+/******************************************************************************
+ * BENCH
+ *
+ * A small harness for timing the moving parts of eo and eod in isolation.
+ * Each benchmark is a subcommand, and reports its result as a line of the
+ * form
+ *
+ *      <name> <count> files <seconds> s <rate> files/s
+ *
+ * so that runs can be compared with diff, or with a little awk. The end
+ * to end benchmark adds a line of latency quantiles.
+ *
+ ******************************************************************************/
+
+#define BENCH_FILES (100000) // default number of files per run
+#define BENCH_EXECS (2000)   // ...and for benchmarks that run a command per file
+#define BENCH_FPR   (0.02)   // false positive rate the filters are sized for
+#define BENCH_RATE  (1000)   // files created per second by the latency benchmark
+#define BENCH_OP    ("true") // command run on each file by the latency benchmark
+
+
+/**
+ * now
+ * ```
+ * Read the monotonic clock.
+ *
+ * Return: the time in seconds.
+ */
+static inline double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * report
+ * ``````
+ * Print the result of a benchmark run.
+ *
+ * @name : name of the benchmark
+ * @n    : number of files processed
+ * @secs : elapsed time in seconds
+ * Return: nothing.
+ */
+void report(const char *name, long n, double secs)
+{
+        printf("%-16s %8ld files %9.4f s %12.0f files/s\n", name, n, secs, n/secs);
+}
+
+
+/**
+ * usage
+ * `````
+ * Print the usage statement to stdout
+ *
+ * Return: nothing.
+ */
+void usage(void)
+{
+        printf("%s\n", USAGE_MESSAGE);
+}
+
+
+
+/******************************************************************************
+ * GENERATOR
+ *
+ * Fill a directory with files, as fast as we can or at a steady rate, as
+ * a camera or a download or whatever eo is pointed at would.
+ *
+ ******************************************************************************/
+
+/**
+ * bench_gen
+ * `````````
+ * Create files in a directory.
+ *
+ * @dir  : the directory (created if need be)
+ * @n    : number of files to create
+ * @rate : files per second, or 0 for as many as possible
+ * Return: nothing.
+ *
+ * NOTE
+ * The schedule is absolute, so a late file is followed by early ones
+ * until the generator has caught up, and the average rate holds.
+ */
+void bench_gen(const char *dir, long n, long rate)
+{
+        struct timespec next;
+        char path[PATHSIZE];
+        long i;
+        int fd;
+
+        if (!exists(dir))
+                mkdir(dir, 0755);
+
+        clock_gettime(CLOCK_MONOTONIC, &next);
+
+        for (i=0; i<n; i++) {
+                if (rate > 0) {
+                        next.tv_nsec += 1000000000 / rate;
+                        while (next.tv_nsec >= 1000000000) {
+                                next.tv_nsec -= 1000000000;
+                                next.tv_sec++;
+                        }
+                        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+                }
+
+                if (snprintf(path, PATHSIZE, "%s/IMG_%08ld.jpg", dir, i) >= PATHSIZE)
+                        bye("bench: Path too long in %s", dir);
+
+                if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+                        bye("bench: Could not create %s", path);
+                close(fd);
+        }
+}
+
+
+/**
+ * bench_rmdir
+ * ```````````
+ * Remove a directory made by bench_gen(), and everything in it.
+ *
+ * @dir  : the directory
+ * Return: nothing.
+ */
+void bench_rmdir(const char *dir)
+{
+        char *argv[] = { "rm", "-rf", (char *)dir, NULL };
+        struct exec_t x = {};
+
+        exec_argv(&x, argv);
+        exec_free(&x);
+}
+
+
+
+/******************************************************************************
+ * SCAN
+ *
+ * List a directory of 'n' files with getdiff(): once when every file is
+ * new, and once more when none are, which is what a pump does on every
+ * rescan. A plain listing of the directory is the baseline for both.
+ *
+ ******************************************************************************/
+
+/**
+ * bench_scan
+ * ``````````
+ * Time getdiff() over a directory.
+ *
+ * @n    : number of files
+ * Return: nothing.
+ */
+void bench_scan(long n)
+{
+        struct diter_t d;
+        struct seen_t *seen;
+        char dir[PATHSIZE];
+        double start;
+        long i;
+
+        snprintf(dir, PATHSIZE, "/tmp/eobench.%d.scan", getpid());
+
+        bench_gen(dir, n, 0);
+
+        if (!diter_open(&d, dir, F_REG, D_FLAT))
+                bye("bench: Could not open directory %s", dir);
+        seen = seen_new(SEEN_MAX);
+
+        start = now();
+        for (i=0; diter_next(&d); i++)
+                ;
+        report("scan-list", i, now() - start);
+
+        start = now();
+        for (i=0; getdiff(&d, seen); i++)
+                ;
+        report("scan-new", i, now() - start);
+
+        start = now();
+        for (i=0; getdiff(&d, seen); i++)
+                ;
+        report("scan-seen", n, now() - start);
+
+        if (i != 0)
+                bye("bench: %ld files came up twice", i);
+
+        seen_del(seen);
+        diter_close(&d);
+        bench_rmdir(dir);
+}
+
+
+
+/******************************************************************************
+ * CHANNEL
+ *
+ * Push 'n' filenames from a forked publisher to a subscriber, once with
+ * one MIN_PIPESIZE message per name (and the DONE/ack round trip at the
+ * end), and once with batched frames under credit flow control.
+ *
+ ******************************************************************************/
+
+/**
+ * bench_legacy
+ * ````````````
+ * Time one-message-per-name transmission over a duplex channel.
+ *
+ * @path : path of an already-created channel
+ * @n    : number of names to send
+ * Return: nothing.
+ */
+void bench_legacy(const char *path, long n)
+{
+        struct dpx_t dpx;
+        char name[PATHSIZE];
+        double start;
+        long i = 0;
+        pid_t pid;
+
+        if ((pid = fork()) == 0) {
+                dpx_open(&dpx, path, CH_PUB);
+                for (i=0; i<n; i++) {
+                        snprintf(name, PATHSIZE, "IMG_%08ld.jpg", i);
+                        dpx_send(&dpx, name);
+                }
+                dpx_send(&dpx, "DONE");
+                dpx_read(&dpx);
+                exit(0);
+        }
+
+        dpx_open(&dpx, path, CH_SUB);
+        start = now();
+
+        for (;;) {
+                dpx_read(&dpx);
+                if (STRCMP(dpx.buf, "DONE")) {
+                        dpx_send(&dpx, "ack");
+                        break;
+                }
+                i++;
+        }
+
+        report("channel-legacy", i, now() - start);
+
+        waitpid(pid, NULL, 0);
+        dpx_close(&dpx);
+}
+
+
+/**
+ * bench_framed
+ * ````````````
+ * Time framed transmission over a duplex channel.
+ *
+ * @path : path of an already-created channel
+ * @n    : number of names to send
+ * Return: nothing.
+ */
+void bench_framed(const char *path, long n)
+{
+        struct dpx_t dpx;
+        char name[PATHSIZE];
+        double start;
+        long i = 0;
+        pid_t pid;
+
+        if ((pid = fork()) == 0) {
+                dpx_open(&dpx, path, CH_PUB);
+                for (i=0; i<n; i++) {
+                        snprintf(name, PATHSIZE, "IMG_%08ld.jpg", i);
+                        dpx_put(&dpx, name);
+                }
+                dpx_push(&dpx);
+                pause(); // keep the channel up until we are killed
+                exit(0);
+        }
+
+        dpx_open(&dpx, path, CH_SUB);
+        start = now();
+
+        while (i < n && dpx_next(&dpx) == FR_DATA)
+                i++;
+
+        report("channel-framed", i, now() - start);
+
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        dpx_close(&dpx);
+}
+
+
+/**
+ * bench_channel
+ * `````````````
+ * Compare the two channel protocols.
+ *
+ * @n    : number of names to send
+ * Return: nothing.
+ */
+void bench_channel(long n)
+{
+        char path[PATHSIZE];
+
+        snprintf(path, PATHSIZE, "/tmp/eobench.%d", getpid());
+
+        dpx_creat(path);
+        bench_legacy(path, n);
+        bench_framed(path, n);
+        dpx_remove(path);
+}
+
+
+
+/******************************************************************************
+ * EXEC
+ *
+ * Run "echo <name>" for 'n' names and collect the output, with popen()
+ * as the shell ops used to, with the exec engine one command per name,
+ * and with the exec engine batching names as xargs does.
+ *
+ ******************************************************************************/
+
+/**
+ * bench_popen
+ * ```````````
+ * Time one popen() per name.
+ *
+ * @n    : number of names
+ * Return: nothing.
+ */
+void bench_popen(long n)
+{
+        char cmd[LINESIZE];
+        char buf[LINESIZE];
+        double start;
+        FILE *pipe;
+        long i;
+
+        start = now();
+
+        for (i=0; i<n; i++) {
+                snprintf(cmd, LINESIZE, "echo IMG_%08ld.jpg", i);
+                pipe = popen(cmd, "r");
+                while (fgets(buf, LINESIZE, pipe))
+                        ;
+                pclose(pipe);
+        }
+
+        report("exec-popen", n, now() - start);
+}
+
+
+/**
+ * bench_spawn
+ * ```````````
+ * Time one exec_run() per name.
+ *
+ * @n    : number of names
+ * Return: nothing.
+ */
+void bench_spawn(long n)
+{
+        struct exec_t x = {};
+        char cmd[LINESIZE];
+        double start;
+        long i;
+
+        start = now();
+
+        for (i=0; i<n; i++) {
+                snprintf(cmd, LINESIZE, "echo IMG_%08ld.jpg", i);
+                exec_run(&x, cmd);
+        }
+
+        report("exec-spawn", n, now() - start);
+
+        exec_free(&x);
+}
+
+
+/**
+ * bench_batch
+ * ```````````
+ * Time batched execution of the names.
+ *
+ * @n    : number of names
+ * Return: nothing.
+ */
+void bench_batch(long n)
+{
+        struct xbatch_t b;
+        char name[PATHSIZE];
+        double start;
+        FILE *null;
+        long i;
+
+        null = sopen("/dev/null", "w");
+        start = now();
+
+        xbatch_open(&b, "echo", null);
+
+        for (i=0; i<n; i++) {
+                snprintf(name, PATHSIZE, "IMG_%08ld.jpg", i);
+                xbatch_add(&b, name);
+        }
+
+        xbatch_close(&b);
+
+        report("exec-batch", n, now() - start);
+
+        sclose(null);
+}
+
+
+/**
+ * bench_exec
+ * ``````````
+ * Compare the ways of running a command per file.
+ *
+ * @n    : number of names
+ * Return: nothing.
+ */
+void bench_exec(long n)
+{
+        bench_popen(n);
+        bench_spawn(n);
+        bench_batch(n);
+}
+
+
+
+/******************************************************************************
+ * LATENCY
+ *
+ * The whole of the pipeline, end to end: a generator creates 'n' files in
+ * a directory at a steady rate, a pump (as pumpd would fork it) sends the
+ * new names down a channel as they turn up, and we run BENCH_OP for each
+ * name as eo would. For each file, the time from its creation (its mtime)
+ * to the op finishing is kept, and the percentiles are taken exactly, by
+ * sorting, rather than from a histogram as pumpd does (see stats.c).
+ *
+ * The rate should be one the op can keep up with; if not, the latency is
+ * mostly the time spent waiting in line, and grows for as long as the run.
+ * The mtime is only as fine as the kernel's clock tick, so figures under a
+ * few milliseconds are noise.
+ *
+ ******************************************************************************/
+
+/**
+ * cmp_usec
+ * ````````
+ * Order two latencies, for qsort().
+ */
+static int cmp_usec(const void *a, const void *b)
+{
+        uint64_t x = *(const uint64_t *)a;
+        uint64_t y = *(const uint64_t *)b;
+
+        return (x > y) - (x < y);
+}
+
+
+/**
+ * percentile
+ * ``````````
+ * Take a percentile of a sorted array of latencies.
+ *
+ * @v    : the latencies, in ascending order
+ * @n    : how many there are
+ * @q    : the quantile, e.g. 0.5 for the median, 0.99 for p99
+ * Return: the latency ranked q of the way up (the same rank that
+ *         hist_quantile() looks for), or 0 if there are none.
+ */
+static uint64_t percentile(const uint64_t *v, long n, double q)
+{
+        long rank = (long)(q * n);
+
+        if (n == 0)
+                return 0;
+
+        return v[(rank < n) ? rank : n - 1];
+}
+
+
+/**
+ * bench_latency
+ * `````````````
+ * Time files from creation to op completion.
+ *
+ * @n    : number of files
+ * @rate : files created per second
+ * Return: nothing.
+ */
+void bench_latency(long n, long rate)
+{
+        struct exec_t x = {};
+        struct dpx_t dpx = {};
+        struct stat st;
+        char dir[PATHSIZE];
+        char id[PATHSIZE];
+        char path[PATHSIZE];
+        double start;
+        pid_t pump;
+        pid_t gen;
+        uint64_t *lat;
+        long m = 0;
+        long i = 0;
+
+        if (!(lat = calloc(n > 0 ? n : 1, sizeof(uint64_t))))
+                bye("bench: Out of memory");
+
+        snprintf(dir, PATHSIZE, "/tmp/eobench.%d.latency", getpid());
+
+        mkdir(dir, 0755);
+
+        if (!exists(CFG_PATH))
+                mkdir(CFG_PATH, 0755);
+
+        /* The channel is made before the pump, as pumpd does */
+        pumps_name(id, 0);
+        dpx_creat(CHANNEL(id));
+
+        if ((pump = fork()) == 0) {
+                open_pump(new_pump(dir, "", id, P_KEEP)); // does not return
+                exit(0);
+        }
+
+        dpx_olink(&dpx, CHANNEL(id), CH_SUB);
+
+        if ((gen = fork()) == 0) {
+                bench_gen(dir, n, rate);
+                exit(0);
+        }
+
+        start = now();
+
+        while (i < n && dpx_next(&dpx) == FR_DATA) {
+                if (snprintf(path, PATHSIZE, "%s/%s", dir, dpx.buf) >= PATHSIZE)
+                        bye("bench: Path too long in %s", dir);
+
+                exec_run(&x, BENCH_OP);
+
+                if (stat(path, &st) == 0)
+                        lat[m++] = usec_now(CLOCK_REALTIME) - usec_of(&st.st_mtim);
+                i++;
+        }
+
+        report("latency", i, now() - start);
+
+        qsort(lat, m, sizeof(uint64_t), cmp_usec);
+
+        printf("%-16s %8ld files %6llu us p50 %6llu us p99 %6llu us max\n", "latency", i,
+                (unsigned long long)percentile(lat, m, 0.50),
+                (unsigned long long)percentile(lat, m, 0.99),
+                (unsigned long long)percentile(lat, m, 1.00));
+
+        free(lat);
+
+        kill(pump, SIGTERM);
+        waitpid(pump, NULL, 0);
+        waitpid(gen, NULL, 0);
+
+        dpx_close(&dpx);
+        exec_free(&x);
+        bench_rmdir(dir);
+}
+
+
+
+/******************************************************************************
+ * BLOOM
+ *
+ * Add 'n' names to a Bloom filter sized for them, look each of them up,
+ * then look up 'n' names that were never added, to time the lookups that
+ * miss and count the false positives. Once for the classic filter, with
+ * one hash function per probe, each probe anywhere in the array, and once
+ * for the blocked filter in bloom.c, one at a time and in bulk.
+ *
+ * Along the way, the rest of bloom.c is checked against what a Bloom
+ * filter promises: that it never loses a key, whether the filter was made
+ * by union or by intersection, or is a counting filter that has had keys
+ * taken out of it again.
+ *
+ ******************************************************************************/
+
+/*
+ * The classic filter, as bloom.c used to have it (PRIVATE)
+ */
+typedef unsigned int (*hashfp_t)(const char *);
+
+struct classic_t {
+        size_t m;
+        size_t k;
+        unsigned char *a;
+        hashfp_t hash[6];
+};
+
+#define SETBIT(a,n) (a[n/CHAR_BIT] |= (1<<(n%CHAR_BIT)))
+#define GETBIT(a,n) (a[n/CHAR_BIT] &  (1<<(n%CHAR_BIT)))
+
+static unsigned int h_djb2(const char *s) { return djb2_hash(s); }
+static unsigned int h_sdbm(const char *s) { return sdbm_hash(s); }
+static unsigned int h_kr  (const char *s) { return kr_hash(s); }
+static unsigned int h_sax (const char *s) { return sax_hash(s); }
+static unsigned int h_dek (const char *s) { return dek_hash(s, strlen(s)); }
+static unsigned int h_fnv (const char *s) { return fnv_hash(s, strlen(s)); }
+
+static void classic_add(struct classic_t *c, const char *s)
+{
+        unsigned int hash;
+        int n;
+
+        for (n=0; n<c->k; n++) {
+                hash = c->hash[n](s);
+                SETBIT(c->a, (hash % c->m));
+        }
+}
+
+static bool classic_check(struct classic_t *c, const char *s)
+{
+        unsigned int hash;
+        int n;
+
+        for (n=0; n<c->k; n++) {
+                hash = c->hash[n](s);
+                if (!(GETBIT(c->a, (hash % c->m))))
+                        return false;
+        }
+        return true;
+}
+
+
+/**
+ * bench_names
+ * ```````````
+ * Make up names to look up.
+ *
+ * @n     : number of names
+ * @prefix: what they start with
+ * Return : array of n names.
+ */
+char **bench_names(long n, const char *prefix)
+{
+        char **names;
+        char buf[PATHSIZE];
+        long i;
+
+        if (!(names = calloc(n, sizeof(char *))))
+                bye("bench: Out of memory");
+
+        for (i=0; i<n; i++) {
+                snprintf(buf, PATHSIZE, "%s_%08ld.jpg", prefix, i);
+                names[i] = sdup(buf);
+        }
+        return names;
+}
+
+
+/**
+ * bench_cbloom
+ * ````````````
+ * Check the counting Bloom filter.
+ *
+ * @in   : names to add, then remove
+ * @n    : number of names
+ * Return: nothing.
+ *
+ * NOTE
+ * Once every key that was added has been removed, every counter must be
+ * back to zero, except those that stuck at CBLOOM_MAX.
+ */
+static void bench_cbloom(char **in, long n)
+{
+        struct cbloom_t *cb;
+        double start;
+        size_t i;
+        int v;
+
+        if (!(cb = cbloom_new(n, BENCH_FPR)))
+                bye("bench: Out of memory");
+
+        start = now();
+        for (i=0; i<n; i++)
+                cbloom_add(cb, in[i]);
+        report("cbloom-add", n, now() - start);
+
+        for (i=0; i<n; i++) {
+                if (!cbloom_check(cb, in[i]))
+                        bye("bench: cbloom_check lost %s", in[i]);
+        }
+
+        start = now();
+        for (i=0; i<n; i++) {
+                if (!cbloom_remove(cb, in[i]))
+                        bye("bench: cbloom_remove lost %s", in[i]);
+        }
+        report("cbloom-remove", n, now() - start);
+
+        for (i=0; i<cb->m; i++) {
+                v = (cb->c[i / 2] >> ((i % 2) * 4)) & 0x0f;
+
+                if (v != 0 && v != CBLOOM_MAX)
+                        bye("bench: cbloom counter %zu not zero after removal", i);
+        }
+
+        cbloom_del(cb);
+}
+
+
+/**
+ * bench_bloom
+ * ```````````
+ * Compare the classic and the blocked Bloom filters.
+ *
+ * @n    : number of names
+ * Return: nothing.
+ *
+ * NOTE
+ * The classic filter gets the same number of bits as the blocked one,
+ * and as many of the six hashes in hashes.h as the blocked one has probes.
+ */
+void bench_bloom(long n)
+{
+        hashfp_t hash[6] = { h_djb2, h_sdbm, h_sax, h_dek, h_fnv, h_kr };
+        struct classic_t c;
+        struct bloom_t *b;
+        struct bloom_t *o;
+        struct bloom_t *x;
+        char **in;
+        char **out;
+        bool *hit;
+        double start;
+        long fp;
+        long i;
+
+        in  = bench_names(n, "IMG");
+        out = bench_names(n, "DSC");
+
+        if (!(b = bloom_new(n, BENCH_FPR)) || !(hit = calloc(n, sizeof(bool))))
+                bye("bench: Out of memory");
+
+        c.m = b->m;
+        c.k = (b->k < 6) ? b->k : 6;
+        c.a = calloc(c.m / CHAR_BIT + 1, 1);
+        memcpy(c.hash, hash, sizeof(hash));
+
+        printf("%ld bits, %zu probes (%zu classic), sized for %.2f%%\n", 
+                (long)b->m, b->k, c.k, BENCH_FPR * 100);
+
+        /* Classic */
+        start = now();
+        for (i=0; i<n; i++)
+                classic_add(&c, in[i]);
+        report("bloom-classic-add", n, now() - start);
+
+        start = now();
+        for (i=0; i<n; i++)
+                classic_check(&c, in[i]);
+        report("bloom-classic-hit", n, now() - start);
+
+        start = now();
+        for (i=fp=0; i<n; i++)
+                fp += classic_check(&c, out[i]);
+        report("bloom-classic-miss", n, now() - start);
+        printf("%-16s %8.4f %% false positives\n", "bloom-classic", 100.0 * fp / n);
+
+        /* Blocked */
+        start = now();
+        for (i=0; i<n; i++)
+                bloom_add(b, in[i]);
+        report("bloom-add", n, now() - start);
+
+        start = now();
+        for (i=0; i<n; i++)
+                bloom_check(b, in[i]);
+        report("bloom-hit", n, now() - start);
+
+        start = now();
+        for (i=fp=0; i<n; i++)
+                fp += bloom_check(b, out[i]);
+        report("bloom-miss", n, now() - start);
+        printf("%-16s %8.4f %% false positives\n", "bloom", 100.0 * fp / n);
+
+        start = now();
+        if (bloom_check_many(b, (const char **)out, n, hit) != fp)
+                bye("bench: bloom_check_many disagrees with bloom_check");
+        report("bloom-miss-many", n, now() - start);
+
+        /* 
+         * Set algebra. The other filter has the names that were never
+         * added, and the first half of those that were, in common.
+         */
+        if (!(o = bloom_new(n, BENCH_FPR)) || !(x = bloom_new(n, BENCH_FPR)))
+                bye("bench: Out of memory");
+
+        for (i=0; i<n; i++)
+                bloom_add(o, out[i]);
+        for (i=0; i<n/2; i++)
+                bloom_add(o, in[i]);
+
+        if (!bloom_union(x, b) || !bloom_union(x, o))
+                bye("bench: bloom_union refused filters of the same shape");
+
+        for (i=0; i<n; i++) {
+                if (!bloom_check(x, in[i]) || !bloom_check(x, out[i]))
+                        bye("bench: bloom_union lost a key");
+        }
+
+        bloom_del(x);
+
+        if (!(x = bloom_new(n, BENCH_FPR)))
+                bye("bench: Out of memory");
+
+        if (!bloom_union(x, b) || !bloom_intersect(x, o))
+                bye("bench: bloom_intersect refused filters of the same shape");
+
+        for (i=0; i<n/2; i++) {
+                if (!bloom_check(x, in[i]))
+                        bye("bench: bloom_intersect lost a common key");
+        }
+
+        bloom_del(o);
+        bloom_del(x);
+
+        bench_cbloom(in, n);
+
+        for (i=0; i<n; i++) {
+                free(in[i]);
+                free(out[i]);
+        }
+        free(in);
+        free(out);
+        free(hit);
+        free(c.a);
+        bloom_del(b);
+}
+
+
+/******************************************************************************
+ * MAIN
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+        long rate;
+        long n;
+
+        if (argc == 1) {
+                usage();
+                return 0;
+        }
+
+        n    = (argc > 2) ? atol(argv[2]) : 0;
+        rate = (argc > 3) ? atol(argv[3]) : 0;
+
+        if (isarg(1, "scan"))
+                bench_scan((n) ? n : BENCH_FILES);
+
+        else if (isarg(1, "channel"))
+                bench_channel((n) ? n : BENCH_FILES);
+
+        else if (isarg(1, "exec"))
+                bench_exec((n) ? n : BENCH_EXECS);
+
+        else if (isarg(1, "latency"))
+                bench_latency((n) ? n : BENCH_EXECS, (rate) ? rate : BENCH_RATE);
+
+        else if (isarg(1, "all")) {
+                bench_scan(BENCH_FILES);
+                bench_channel(BENCH_FILES);
+                bench_exec(BENCH_EXECS);
+                bench_latency(BENCH_EXECS, BENCH_RATE);
+        }
+
+        else if (isarg(1, "bloom"))
+                bench_bloom((n) ? n : BENCH_FILES);
+
+        else if (isarg(1, "help") || isarg(1, "?"))
+                usage();
+
+        return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#define USAGE_MESSAGE \
+"  NAME                                                                 \n"\
+"         bench -- time the moving parts of eo and eod                  \n"\
+"                                                                       \n"\
+"  SYNOPSIS                                                             \n"\
+"         bench [benchmark] ([count]) ([rate])                          \n"\
+"                                                                       \n"\
+"  BENCHMARKS                                                           \n"\
+"         The following benchmarks are supported:                       \n"\
+"                                                                       \n"\
+"         scan         list a directory of files with getdiff, when     \n"\
+"                      they are all new, and when none of them are      \n"\
+"         channel      send filenames through a duplex channel, one     \n"\
+"                      message per name and then in batched frames      \n"\
+"         exec         run a command per file with popen, with spawn,   \n"\
+"                      and in xargs-style batches                       \n"\
+"         bloom        add and look up names in the classic and in the  \n"\
+"                      blocked Bloom filter                             \n"\
+"         latency      create files at [rate] per second, pump them,    \n"\
+"                      run a command on each, and report p50/p99 of     \n"\
+"                      the time from creation to the command finishing  \n"\
+"         all          scan, channel, exec and latency, with defaults   \n"\
+"         help         print this screen                                \n"
+
+#endif
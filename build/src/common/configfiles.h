@@ -96,6 +96,30 @@ static inline const char *__pid_path(void)
 }
 
 
+#define STAT_NAME ("pumpd.stat")
+#define STAT_PATH (__stat_path())
+/**
+ * __stat_path
+ * ```````````
+ * Returns the path of the stat file.
+ *
+ * NOTES
+ * The pump daemon keeps a few figures about itself in the stat file,
+ * one "key value" pair per line, for 'pumpd stat' and anyone else who
+ * is curious.
+ *
+ * This is an implementation function that is called through the 
+ * STAT_PATH macro defined above.
+ */
+static inline const char *__stat_path(void)
+{
+        static char buf[PATHSIZE];
+        if (!HOME) HOME = sdup(gethome());
+        snprintf(buf, PATHSIZE, "%s/%s/%s", HOME, CFG_NAME, STAT_NAME);
+        return buf;
+}
+
+
 #define CHANNEL(stem) (__channel_path(stem))
 #define CH(stem)      (CHANNEL(stem))
 /**
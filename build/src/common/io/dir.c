@@ -2,25 +2,28 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #include "../textutils.h"
 #include "../util.h"
 #include "../error.h"
-#include "../bits.h"
-#include "../lib/bloom/bloom.h"
 #include "dir.h"
 #include "file.h"
+#include "seen.h"
 
 
-/****************************************************************************** 
+/******************************************************************************
  * DIRECTORY ENTRY GENERATORS
- * 
- * Internally, this module uses the functions _diterate() and diterate()
- * to provide a uniform iteration interface for all other functions listed 
+ *
+ * Internally, this module uses an iterator object, struct diter_t, to
+ * provide a uniform iteration interface for all other functions listed
  * in this source file.
  *
  * A generator is a special function that controls the iteration behavior
@@ -28,189 +31,336 @@
  * the values all at once, it yields them one at a time.
  *
  * The most familiar example of generator behavior is strtok(), which allows
- * for continutation. In practice, strtok() accepts a valid pointer to signal 
- * a fresh invocation, and subsequent "continuation" calls are indicated by
- * passing a NULL pointer in place of the valid one.
+ * for continutation by keeping its place in a static variable. That is
+ * also its great failing; two loops cannot run at once, whether they are
+ * nested, in different threads, or simply interleaved. strtok_r() solves
+ * this by handing the caller the state to hold on to, and so do we. All of
+ * the state of an iteration lives in the iterator, and the caller owns it:
  *
- * There is a good example from the strtok_r manpage that constructs this 
- * convention as a for loop, Adapted to our purposes, it would look like:
+ *      struct diter_t d;
+ *      const char *name;
  *
- *      struct dirent *entry; 
- *      DIR *dir;
+ *      diter_open(&d, "some/dir", F_REG, D_FLAT);
  *
- *      for (entry = _diterate(dir));
- *           entry != NULL;
- *           entry = _diterate(NULL)) 
- *      {
- *              ...do something with entry
+ *      while ((name = diter_next(&d))) {
+ *              ...do something with name
  *      }
  *
- * This still looks more like a hack than a generator. Wikipedia sayeth:
+ *      diter_close(&d);
  *
- *       "In short, a generator *looks* like a function but *behaves* 
- *       like an iterator."
+ * When the iteration runs out, the iterator rewinds itself, so the same
+ * loop can be run again to rescan the directory.
  *
- * The for loop construct is some halfway horror between these two ideals.
- * To nudge it toward readability, we move the canonical form to an
- * implementation function, _diterate(), and wrap this with diterate(). 
- *
- * diterate() keeps track of the continuation status of the generator,
- * so the caller can forgo the initialization step. This allows for a while 
- * loop, with the termination condition triggered implicitly.
- *
- * Thus sugar-coated, the generator assumes a brevity exemplified by the 
+ * Thus sugar-coated, the generator assumes a brevity exemplified by the
  * filecount() function:
  *
- *      int filecount(DIR *dir, int filter)
+ *      int filecount(struct diter_t *d)
  *      {
- *              struct dirent *entry;
  *              int count = 0;
  *
- *              while ((entry = diterate(dir, filter))) {
+ *              while (diter_next(d))
  *                      count++;
- *              }
  *
  *              return count;
  *      }
  *
- * CAVEAT
- * These functions are not re-entrant safe!
- *
- ******************************************************************************/
-
-/**
- * _diterate 
- * `````````
- * Provides iteration over directory contents to diterate()
- * 
- * @dir   : an open directory stream
- * @filter: a set of predicates (see note on file predicates)
- * Return : a struct dirent pointer set to the current item 
- *
- * USAGE
- * Invocation is similar to strtok(), see note above.
- *
- * NOTES
- * This is an internal function which is wrapped by diterate().
- *
- * CAVEAT
- * The call to stat() has been a rich source of bugs. It expects a
- * file path as its first argument, and many heads were scratched
- * before realizing that the name of the directory entry would only 
- * produce a valid path if the current working directory was the same 
- * as the path the DIR stream was opened at.
- *
- * cwd--+-somedir
- *      +-subdir--+-file0
- *                +-file1
- *                +-file2
+ * How it works
+ * ------------
  *
- * If we are executing in cwd, and open the DIR stream with 
+ * The iterator holds its own directory file descriptor, and reads entries
+ * in bulk with getdents64(2), many to a system call. Most filesystems will
+ * report the type of each entry in d_type, and in that case the filter is
+ * applied without a stat. Only entries of unknown type (DT_UNKNOWN), and
+ * symlinks, whose type is that of their target, are stat'ed.
  *
- *      DIR *dir = opendir(subdir),
+ * When a stat is needed, it is done with fstatat(2) against the iterator's
+ * directory descriptor. This sidesteps the old problem of stat() resolving
+ * entry names against the working directory of the process instead of the
+ * directory being iterated, without having to chdir() back and forth.
  *
- * and we retreive the entries of the directory stream with
+ * Symlinks are followed: a link to a regular file is a regular file, and
+ * its stat (and so its key in a seen-set) is that of the file it points
+ * to. The directory watch does the same (see watch_next()), so a file is
+ * the same file whichever of the two finds it first.
  *
- *      char *entry = readdir(dir);
+ * With D_RECURSE, the iterator descends into each subdirectory after it
+ * is reached (and yielded, if the filter asks for directories), up to
+ * DITER_DEPTH levels deep. Each level gets a descriptor and buffer of
+ * its own. Names are yielded relative to the root of the iteration, e.g.
+ * "subdir/file0". Symlinks to directories are not followed.
  *
- * we're going to get values that look like
- *
- *      entry == "file0"
- *      entry == "file1"
- *      entry == "file2".
+ * CAVEAT
+ * An iterator is re-entrant, but it is not itself safe to share between
+ * threads. Give each thread its own.
  *
- * When we give these paths to stat(), we're in trouble because stat()
- * naturally assumes that all relative paths are rooted in the current 
- * working directory, 'cwd'. 
+ ******************************************************************************/
+
+struct linux_dirent64 {
+        uint64_t       d_ino;
+        int64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[];
+};
+
+
+/**
+ * diter_push
+ * ``````````
+ * Open a level of the iteration.
+ *
+ * @d    : pointer to an iterator
+ * @fd   : directory file descriptor for the new level
+ * @plen : length of the new level's prefix in d->path
+ * Return: nothing.
+ */
+static void diter_push(struct diter_t *d, int fd, size_t plen)
+{
+        struct dlevel_t *lv = &d->lv[d->depth];
+
+        if (!lv->buf && !(lv->buf = malloc(DITER_BUFSIZE)))
+                bye("diter: Out of memory");
+
+        lv->fd   = fd;
+        lv->pos  = 0;
+        lv->len  = 0;
+        lv->plen = plen;
+}
+
+
+/**
+ * diter_pop
+ * `````````
+ * Close the deepest level of the iteration and return to its parent.
  *
- * In fact, these paths are relative to the root of the DIR stream, 
- * 'subdir'. So stat() returns negative, unless the path of the DIR 
- * stream just happens to coincide with the current working directory, 
- * in which case it works as intended.
+ * @d    : pointer to an iterator
+ * Return: nothing.
+ */
+static void diter_pop(struct diter_t *d)
+{
+        close(d->lv[d->depth].fd);
+        d->lv[d->depth].fd = -1;
+        d->depth--;
+}
+
+
+/**
+ * diter_descend
+ * `````````````
+ * Enter the directory named by the current entry.
  *
- * The solution was to write the function getdirpath() (see file.c) and
- * use it to set the cwd before the call to _diterate() in the wrapper 
- * function diterate(), and then revert the directory once _diterate()
- * returned. It works... for now.
+ * @d    : pointer to an iterator
+ * Return: nothing (the directory is skipped if it cannot be opened).
  */
-struct dirent *_diterate(DIR *dir, int filter)
+static void diter_descend(struct diter_t *d)
 {
-        struct dirent *entry;
-        struct stat dstat;
+        size_t plen;
+        int fd;
+
+        d->descend = false;
+
+        if (d->depth + 1 >= DITER_DEPTH)
+                return;
 
-        static DIR *_dir;
+        fd = openat(d->lv[d->depth].fd, d->name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 
+        if (fd == -1)
+                return;
 
-        if (dir != NULL) {
-                _dir = dir;
+        plen = strlen(d->path);
+
+        if (plen + 2 >= PATHSIZE) {
+                close(fd);
+                return;
         }
 
-        while ((entry = readdir(_dir)), entry != NULL) {
+        d->path[plen++] = '/';
+        d->path[plen]   = '\0';
 
-                /* If we cannot stat a file, we move on. */
-                if (stat(entry->d_name, &dstat) == -1)
-                        continue;
+        d->depth++;
+        diter_push(d, fd, plen);
+}
 
-                /* If file is hidden and we don't have F_HID, move on */
-                if (entry->d_name[0] == '.')
-                        continue;
 
-                /* If filetype is not included in the filter, move on */
-                if (!(hasvalue(filter, F_TYPE(dstat.st_mode))))
-                        continue;
+/**
+ * diter_open
+ * ``````````
+ * Open an iterator over the entries of a directory.
+ *
+ * @d     : pointer to an uninitialized iterator
+ * @path  : path of the directory
+ * @filter: file type to yield (see note on file predicates), or 0 for all
+ * @flags : D_FLAT or D_RECURSE
+ * Return : false if the directory could not be opened (see errno),
+ *          otherwise true.
+ */
+bool diter_open(struct diter_t *d, const char *path, int filter, int flags)
+{
+        int fd;
+
+        if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+                return false;
+
+        memset(d, 0, sizeof(struct diter_t));
+
+        d->filter = filter;
+        d->flags  = flags;
+        d->depth  = 0;
+
+        diter_push(d, fd, 0);
+
+        return true;
+}
+
+
+/**
+ * diter_close
+ * ```````````
+ * Close an iterator and release everything it holds.
+ *
+ * @d    : pointer to an open iterator
+ * Return: nothing.
+ */
+void diter_close(struct diter_t *d)
+{
+        int i;
 
-                return entry;
+        while (d->depth > 0)
+                diter_pop(d);
+
+        close(d->lv[0].fd);
+        d->lv[0].fd = -1;
+
+        for (i=0; i<DITER_DEPTH; i++) {
+                free(d->lv[i].buf);
+                d->lv[i].buf = NULL;
         }
-        /* Finished scanning directory */
-        rewinddir(_dir);
-        return NULL;
 }
 
 
 /**
- * diterate
- * ````````
- * Provide a uniform directory entry generator.
+ * diter_rewind
+ * ````````````
+ * Return an iterator to the start of its directory.
+ *
+ * @d    : pointer to an open iterator
+ * Return: nothing.
+ */
+void diter_rewind(struct diter_t *d)
+{
+        while (d->depth > 0)
+                diter_pop(d);
+
+        lseek(d->lv[0].fd, 0, SEEK_SET);
+
+        d->lv[0].pos = 0;
+        d->lv[0].len = 0;
+        d->descend   = false;
+}
+
+
+/**
+ * diter_stat
+ * ``````````
+ * Get the stat of the current entry.
  *
- * @dir   : open directory stream
- * @filter: a set of predicates (see note on file predicates)
- * Return : struct dirent pointing to the current item
+ * @d    : pointer to an open iterator
+ * Return: pointer to the stat, or NULL if the entry could not be stat'ed.
  *
  * NOTE
- * All the working directory jumps are addressing a bug outlined
- * in the notes for _diterate(), above.
+ * The stat is made at most once per entry, and only if it is asked for,
+ * either here or by the filter. Symlinks are followed (see above).
  */
-struct dirent *diterate(DIR *dir, int filter)
+const struct stat *diter_stat(struct diter_t *d)
 {
-        /* Used to resolve relative paths */
-        static struct cwd_t cwd;
-        static bool running = false;
-        struct dirent *entry;
-        DIR *_dir = NULL; 
-
-        if (!running) {
-                _dir    = dir;
-                running = true;
-                cwd_setjump(&cwd, getdirpath(dir));
+        if (!d->have_st) {
+                if (fstatat(d->lv[d->depth].fd, d->name, &d->st, 0) == -1)
+                        return NULL;
+                d->have_st = true;
         }
+        return &d->st;
+}
+
+
+/**
+ * diter_next
+ * ``````````
+ * Yield the next entry of the directory that passes the filter.
+ *
+ * @d    : pointer to an open iterator
+ * Return: path of the entry relative to the directory, or NULL when the
+ *         iteration is finished (the iterator is then rewound).
+ */
+const char *diter_next(struct diter_t *d)
+{
+        struct linux_dirent64 *ent;
+        struct dlevel_t *lv;
+        const struct stat *st;
+        int type;
+
+        if (d->descend)
+                diter_descend(d);
+
+        for (;;) {
+                lv = &d->lv[d->depth];
+
+                /* Refill the buffer for this level */
+                if (lv->pos >= lv->len) {
+                        lv->len = syscall(SYS_getdents64, lv->fd, lv->buf, DITER_BUFSIZE);
+                        lv->pos = 0;
+
+                        if (lv->len <= 0) {
+                                /* Finished this level */
+                                if (d->depth == 0) {
+                                        diter_rewind(d);
+                                        return NULL;
+                                }
+                                diter_pop(d);
+                                continue;
+                        }
+                }
+
+                ent      = (struct linux_dirent64 *)(lv->buf + lv->pos);
+                lv->pos += ent->d_reclen;
+
+                /* Skip ".", ".." and hidden files */
+                if (ent->d_name[0] == '.')
+                        continue;
+
+                if (lv->plen + strlen(ent->d_name) >= PATHSIZE)
+                        continue;
 
-        /* Jump to directory root */
-        cwd_jump(&cwd); 
+                slcpy(d->path + lv->plen, ent->d_name, PATHSIZE - lv->plen);
+                d->name    = d->path + lv->plen;
+                d->have_st = false;
 
-        entry = _diterate(_dir, filter);
+                /* Only stat when d_type can't answer the filter */
+                if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+                        if (!(st = diter_stat(d)))
+                                continue;
+                        type = F_TYPE(st->st_mode);
+                } else {
+                        type = DTTOIF(ent->d_type);
+                }
 
-        /* Return to working directory */
-        cwd_jump(&cwd);
+                if (type == F_DIR && (d->flags & D_RECURSE))
+                        d->descend = true;
 
-        if (entry == NULL)
-                running = false;
+                /* If filetype is not included in the filter, move on */
+                if (d->filter && type != d->filter) {
+                        if (d->descend)
+                                diter_descend(d);
+                        continue;
+                }
 
-        return entry;
+                return d->path;
+        }
 }
 
 
 /******************************************************************************
- * NON-GENERATIVE 
+ * NON-GENERATIVE
  *
  * These functions use the directory entry generators, but are not intended
  * to be used as generators themselves. They perform a one-and-done traversal
@@ -220,38 +370,35 @@ struct dirent *diterate(DIR *dir, int filter)
 
 
 /**
- * filecount 
+ * filecount
  * `````````
  * Count the number of files in a directory
  *
- * @dir   : open directory stream
- * @filter: a set of predicates (see note on file predicates)
- * Return : the number of files in 'dir' which passed the filter
+ * @d     : open directory iterator
+ * Return : the number of files which passed the iterator's filter
  *
  * NOTE
  * This is a one-and-done traversal of the directory entries, with
  * a definite sum that is returned to the caller.
  */
-int filecount(DIR *dir, int filter)
+int filecount(struct diter_t *d)
 {
-        struct dirent *entry;
         int count = 0;
 
-        while ((entry = diterate(dir, filter))) {
+        while (diter_next(d))
                 count++;
-        }
 
         return count;
 }
 
 
 /******************************************************************************
- * GENERATIVE 
+ * GENERATIVE
  *
- * These are the public generator functions availible for retreiving 
- * information about the set of files (entries) in a directory stream. 
- * They use the directory entry generators outlined above, yielding
- * data about each entry to the caller in a serial fashion.
+ * These are the public generator functions availible for retreiving
+ * information about the set of files (entries) in a directory. They
+ * use the directory entry generators outlined above, yielding data
+ * about each entry to the caller in a serial fashion.
  *
  ******************************************************************************/
 
@@ -259,73 +406,50 @@ int filecount(DIR *dir, int filter)
 /**
  * getfile
  * ```````
- * Yield the filenames of each entry in a directory stream.
+ * Yield the filenames of each entry in a directory.
  *
- * @dir   : open directory stream
- * @filter: a set of predicates (see note on file predicates)
+ * @d     : open directory iterator
  * Return : the filename of the current entry in the iteration
  */
-const char *getfile(DIR *dir, int filter)
+const char *getfile(struct diter_t *d)
 {
-        struct dirent *entry;
-
-        while ((entry = diterate(dir, filter))) {
-                return entry->d_name;
-        }
-
-        return NULL;
+        return diter_next(d);
 }
 
 
 /**
  * getdiff
  * ```````
- * Yield the filename of each entry in a directory stream exactly once.
+ * Yield the filename of each entry in a directory exactly once.
  *
- * @dir   : open directory stream
- * @filter: a set of predicates (see note on file predicates)
+ * @d     : open directory iterator
+ * @seen  : the set of files already yielded
  * Return : the filename of the current unique entry in the iteration
  *
- * TODO
- * A mechanism to re-set the Bloom filter.
- *
  * NOTES
- * getdiff() remembers the filenames it has already yielded, even across 
+ * getdiff() remembers the files it has already yielded, even across
  * multiple continuations. This is not the same as maintaining state
  * between calls, like all generators, but between multiple traversals
- * of the directory entirely. 
+ * of the directory entirely. That memory is the seen-set (see seen.c),
+ * which belongs to the caller.
  *
  * USAGE
- * getdiff() will only yield those filenames which have changed between 
- * continuations, so that you can repeatedly scan a directory without 
- * re-listing the same entries every time. 
+ * getdiff() will only yield those files which have changed between
+ * continuations, so that you can repeatedly scan a directory without
+ * re-listing the same entries every time. A file that is replaced or
+ * rewritten counts as changed.
  */
-const char *getdiff(DIR *dir, int filter)
+const char *getdiff(struct diter_t *d, struct seen_t *seen)
 {
-        static struct bloom_t *bloom;
-        struct dirent *entry;
-
-        /* Construct the Bloom filter */
-        if (!bloom)
-                bloom = bloom_new(250000, 3, fnv_hash, sdbm_hash, djb2_hash);
-
-        while ((entry = diterate(dir, filter))) {
-                /* 
-                 * If the filename is in the Bloom filter, continue. 
-                 */
-                if (bloom_check(bloom, entry->d_name))
-                        continue;
+        const struct stat *st;
+        const char *name;
 
-                /* 
-                 * Otherwise, it is probably a new entry. 
-                 * Add it to the Bloom filter and yield 
-                 * it to the caller 
-                 */
-                bloom_add(bloom, entry->d_name);
-
-                return entry->d_name;
+        while ((name = diter_next(d))) {
+                if (!(st = diter_stat(d)))
+                        continue;
+                if (seen_add(seen, st))
+                        return name;
         }
         return NULL; /* signals end of iteration run */
 }
 
-
@@ -1,16 +1,68 @@
 #ifndef _DIR_LISTING_H
 #define _DIR_LISTING_H
 
+#include <stdbool.h>
+#include <sys/stat.h>
 
-/* Procedures 
+#include "file.h"
+#include "seen.h"
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define DITER_BUFSIZE (32 * 1024) // Bytes of entries read at once, per level
+#define DITER_DEPTH   (16)        // Deepest recursive descent
+
+
+/* Iterator flags
+``````````````````````````````````````````````````````````````````````````````*/
+#define D_FLAT    0x00 // Only the entries of the directory itself
+#define D_RECURSE 0x01 // Descend into subdirectories
+
+
+/* Directory iterator
+``````````````````````````````````````````````````````````````````````````````*/
+struct dlevel_t {
+        int    fd;   // open directory at this level
+        char  *buf;  // raw entries, as read by getdents64
+        long   pos;  // cursor into 'buf'
+        long   len;  // number of bytes of entries in 'buf'
+        size_t plen; // length of this level's prefix in the path
+};
+
+struct diter_t {
+        int filter;                      // file type to yield (0 for all)
+        int flags;                       // D_FLAT or D_RECURSE
+        int depth;                       // current level of descent
+        bool descend;                    // descend into 'path' next time
+        struct dlevel_t lv[DITER_DEPTH]; // one per level of descent
+        char path[PATHSIZE];             // current entry, relative to root
+        const char *name;                // basename of the current entry
+        bool have_st;                    // whether 'st' is current
+        struct stat st;                  // stat of the current entry
+};
+
+bool diter_open  (struct diter_t *d, const char *path, int filter, int flags);
+void diter_close (struct diter_t *d);
+void diter_rewind(struct diter_t *d);
+const char        *diter_next(struct diter_t *d);
+const struct stat *diter_stat(struct diter_t *d);
+
+static inline int diter_fd(struct diter_t *d)
+{
+        return d->lv[0].fd;
+}
+
+
+/* Procedures
 ``````````````````````````````````````````````````````````````````````````````*/
-int filecount(DIR *dir, int options);
+int filecount(struct diter_t *d);
 
 
 /* Generators
 ``````````````````````````````````````````````````````````````````````````````*/
-const char *getfile(DIR *dir, int options);
-const char *getdiff(DIR *dir, int filter);
+const char *getfile(struct diter_t *d);
+const char *getdiff(struct diter_t *d, struct seen_t *seen);
 
 
 #endif
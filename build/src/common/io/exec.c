@@ -0,0 +1,503 @@
+#define USE_ERRNO_H
+#define _GNU_SOURCE // pipe2
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "file.h"
+#include "exec.h"
+#include "../error.h"
+#include "../textutils.h"
+
+extern char **environ;
+
+
+/******************************************************************************
+ * COMMAND EXECUTION
+ *
+ * Running a command for each file is the whole point of eo, and it used to
+ * be done with popen(), which forks the process, execs /bin/sh, and has the
+ * shell parse the command, fork, and exec it again. Per file.
+ *
+ * Direct execution
+ * ----------------
+ *
+ * Most commands are nothing more than a handful of words, e.g.
+ *
+ *      convert -resize 50% IMG_0001.jpg
+ *
+ * and need nothing from the shell but to be split on whitespace. When a
+ * command contains none of the characters in EXEC_META, we split it here,
+ * and run it with posix_spawn(), which on Linux is a vfork(), so that the
+ * page tables of the caller are not copied either. Anything with quotes,
+ * pipes, globs, variables, redirections and so forth goes to /bin/sh -c,
+ * exactly as before. So does a command that starts with one of the shell's
+ * own builtins, like cd or export, since there is no program by that name
+ * to spawn (see EXEC_BUILTINS).
+ *
+ * In both cases the whole of stdout is captured, however long, along with
+ * the exit status of the command.
+ *
+ * Batches
+ * -------
+ *
+ * A command that takes its filenames at the end, like "rm" or "gzip -9",
+ * can be run once for many of them, as xargs(1) does. An xbatch_t collects
+ * filenames until the next one would push the arguments past the limit of
+ * the kernel (ARG_MAX, less the environment and some headroom, and at most
+ * EXEC_BATCH), then runs the command once for all of them. A command that
+ * needs the shell is run as
+ *
+ *      /bin/sh -c '<command> "$@"' sh <name> <name> ...
+ *
+ * so that the names are passed as arguments, and never parsed by the shell.
+ *
+ ******************************************************************************/
+
+#define EXEC_META   "|&;<>()$`\\\"'*?[]#~=!{}\n"
+#define EXEC_CHUNK  (4096)
+
+/* Builtins of sh(1) that are not also programs in the PATH */
+static const char *EXEC_BUILTINS[] = {
+        ".", "alias", "bg", "break", "cd", "command", "continue", "eval",
+        "exec", "exit", "export", "fg", "getopts", "hash", "jobs", "local",
+        "read", "readonly", "return", "set", "shift", "source", "times",
+        "trap", "type", "ulimit", "umask", "unalias", "unset", "wait",
+};
+
+#define EXEC_NBUILTINS (sizeof(EXEC_BUILTINS) / sizeof(EXEC_BUILTINS[0]))
+
+
+/**
+ * exec_split
+ * ``````````
+ * Split a command into words, in place.
+ *
+ * @buf  : the command (altered)
+ * @argv : destination of the words
+ * @max  : number of slots in 'argv'
+ * Return: number of words, or -1 if there are too many.
+ */
+static int exec_split(char *buf, char **argv, int max)
+{
+        int argc = 0;
+
+        for (;;) {
+                while (*buf == ' ' || *buf == '\t')
+                        *buf++ = '\0';
+
+                if (*buf == '\0')
+                        break;
+
+                if (argc == max - 1)
+                        return -1;
+
+                argv[argc++] = buf;
+
+                while (*buf && *buf != ' ' && *buf != '\t')
+                        buf++;
+        }
+
+        argv[argc] = NULL;
+
+        return argc;
+}
+
+
+/**
+ * exec_argmax
+ * ```````````
+ * Work out how many bytes of arguments a command may be given.
+ *
+ * Return: the number of bytes.
+ *
+ * NOTE
+ * Each argument costs its length, its terminator, and a pointer. The
+ * environment is passed along with the arguments, and counts against
+ * the same limit.
+ */
+static size_t exec_argmax(void)
+{
+        long max = sysconf(_SC_ARG_MAX);
+        char **e;
+
+        if (max <= 0)
+                max = _POSIX_ARG_MAX;
+
+        for (e=environ; e && *e; e++)
+                max -= strlen(*e) + 1 + sizeof(char *);
+
+        max -= 2048; // headroom, as POSIX advises for xargs
+
+        if (max > EXEC_BATCH)
+                max = EXEC_BATCH;
+
+        return (max < 1024) ? 1024 : max;
+}
+
+
+/**
+ * exec_builtin
+ * ````````````
+ * Check whether a command starts with a builtin of the shell.
+ *
+ * @cmd  : the command
+ * Return: true if its first word is in EXEC_BUILTINS, otherwise false.
+ */
+static bool exec_builtin(const char *cmd)
+{
+        size_t len;
+        size_t i;
+
+        cmd += strspn(cmd, " \t");
+        len  = strcspn(cmd, " \t");
+
+        for (i=0; i<EXEC_NBUILTINS; i++) {
+                if (strlen(EXEC_BUILTINS[i]) == len && !strncmp(cmd, EXEC_BUILTINS[i], len))
+                        return true;
+        }
+
+        return false;
+}
+
+
+/**
+ * exec_plain
+ * ``````````
+ * Check whether a command can be run without a shell.
+ *
+ * @cmd  : the command
+ * Return: true if it can, otherwise false.
+ */
+bool exec_plain(const char *cmd)
+{
+        return cmd[strcspn(cmd, EXEC_META)] == '\0' && strlen(cmd) < LINESIZE
+            && !exec_builtin(cmd);
+}
+
+
+/**
+ * exec_empty
+ * ``````````
+ * Check whether a command has no words in it.
+ *
+ * @cmd  : the command
+ * Return: true if it is empty or blank, otherwise false.
+ */
+bool exec_empty(const char *cmd)
+{
+        return cmd[strspn(cmd, " \t")] == '\0';
+}
+
+
+/**
+ * exec_spawn
+ * ``````````
+ * Start a command, with its stdout on a pipe to the caller.
+ *
+ * @argv : the command and its arguments, NULL-terminated
+ * @fd   : destination of the read end of the pipe
+ * Return: pid of the command, or -1 if it could not be started.
+ */
+pid_t exec_spawn(char *const argv[], int *fd)
+{
+        posix_spawn_file_actions_t fa;
+        int pfd[2];
+        pid_t pid;
+        int err;
+
+        if (pipe2(pfd, O_CLOEXEC) == -1)
+                return -1;
+
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, pfd[1], STDOUT_FILENO);
+
+        err = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+
+        posix_spawn_file_actions_destroy(&fa);
+        close(pfd[1]);
+
+        if (err != 0) {
+                close(pfd[0]);
+                errno = err;
+                return -1;
+        }
+
+        *fd = pfd[0];
+
+        return pid;
+}
+
+
+/**
+ * exec_argv
+ * `````````
+ * Run a command to completion and collect its output.
+ *
+ * @x    : destination of the result (its buffer is reused)
+ * @argv : the command and its arguments, NULL-terminated
+ * Return: the exit status of the command.
+ */
+int exec_argv(struct exec_t *x, char *const argv[])
+{
+        ssize_t n;
+        pid_t pid;
+        int status;
+        int fd;
+
+        x->len = 0;
+
+        if (x->cap == 0) {
+                if (!(x->out = malloc(EXEC_CHUNK)))
+                        bye("exec: Out of memory");
+                x->cap = EXEC_CHUNK;
+        }
+        x->out[0] = '\0';
+
+        if ((pid = exec_spawn(argv, &fd)) == -1)
+                return (x->status = 127); // as the shell reports it
+
+        for (;;) {
+                if (x->cap - x->len < EXEC_CHUNK) {
+                        if (!(x->out = realloc(x->out, x->cap * 2)))
+                                bye("exec: Out of memory");
+                        x->cap *= 2;
+                }
+
+                n = read(fd, x->out + x->len, x->cap - x->len - 1);
+
+                if (n > 0)
+                        x->len += n;
+                else if (n == 0 || errno != EINTR)
+                        break;
+        }
+        x->out[x->len] = '\0';
+
+        close(fd);
+
+        while (waitpid(pid, &status, 0) == -1) {
+                if (errno != EINTR)
+                        bye("exec: Could not wait for %s", argv[0]);
+        }
+
+        if (WIFEXITED(status))
+                x->status = WEXITSTATUS(status);
+        else
+                x->status = 128 + WTERMSIG(status);
+
+        return x->status;
+}
+
+
+/**
+ * exec_run
+ * ````````
+ * Run a command line to completion and collect its output.
+ *
+ * @x    : destination of the result (its buffer is reused)
+ * @cmd  : the command line
+ * Return: the exit status of the command.
+ *
+ * NOTE
+ * The shell is only used if the command needs it (see exec_plain).
+ */
+int exec_run(struct exec_t *x, const char *cmd)
+{
+        char *argv[EXEC_ARGS];
+        char buf[LINESIZE];
+
+        if (exec_plain(cmd)) {
+                slcpy(buf, cmd, LINESIZE);
+
+                switch (exec_split(buf, argv, EXEC_ARGS)) {
+                case 0:
+                        /* Nothing to run */
+                        x->len    = 0;
+                        x->status = 0;
+                        return 0;
+                case -1:
+                        break;
+                default:
+                        return exec_argv(x, argv);
+                }
+        }
+
+        argv[0] = EXEC_SHELL;
+        argv[1] = "-c";
+        argv[2] = (char *)cmd;
+        argv[3] = NULL;
+
+        return exec_argv(x, argv);
+}
+
+
+/**
+ * exec_free
+ * `````````
+ * Release the buffer of a result.
+ *
+ * @x    : pointer to a result
+ * Return: nothing.
+ */
+void exec_free(struct exec_t *x)
+{
+        free(x->out);
+        x->out = NULL;
+        x->len = x->cap = 0;
+}
+
+
+
+/******************************************************************************
+ * BATCHES
+ ******************************************************************************/
+
+/**
+ * xbatch_open
+ * ```````````
+ * Prepare a batch for a command.
+ *
+ * @b    : pointer to an uninitialized batch
+ * @cmd  : the command, to which the names will be appended
+ * @out  : where the output of the command goes
+ * Return: nothing.
+ *
+ * CAVEAT
+ * An empty command is fatal: with no fixed words, the first name would
+ * be run as the program. Callers check with exec_empty first.
+ */
+void xbatch_open(struct xbatch_t *b, const char *cmd, FILE *out)
+{
+        size_t len;
+        int i;
+
+        if (exec_empty(cmd))
+                bye("exec: Empty command for a batch");
+
+        memset(b, 0, sizeof(struct xbatch_t));
+
+        b->out = out;
+        b->cap = EXEC_ARGS + 256;
+
+        if (!(b->argv = calloc(b->cap, sizeof(char *))))
+                bye("exec: Out of memory");
+
+        if (exec_plain(cmd)) {
+                b->words = strdup(cmd);
+                b->base  = exec_split(b->words, b->argv, EXEC_ARGS);
+        }
+
+        if (!exec_plain(cmd) || b->base < 0) {
+                len = strlen(cmd) + sizeof(" \"$@\"");
+
+                if (!(b->words = realloc(b->words, len)))
+                        bye("exec: Out of memory");
+
+                snprintf(b->words, len, "%s \"$@\"", cmd);
+
+                b->argv[0] = EXEC_SHELL;
+                b->argv[1] = "-c";
+                b->argv[2] = b->words;
+                b->argv[3] = "sh";     // $0
+                b->base    = 4;
+        }
+
+        b->argc = b->base;
+        b->max  = exec_argmax();
+
+        for (i=0; i<b->base; i++)
+                b->max -= strlen(b->argv[i]) + 1 + sizeof(char *);
+}
+
+
+/**
+ * xbatch_add
+ * ``````````
+ * Add a name to a batch, running the command first if it will not fit.
+ *
+ * @b    : pointer to an open batch
+ * @name : filename to add
+ * Return: nothing.
+ */
+void xbatch_add(struct xbatch_t *b, const char *name)
+{
+        size_t size = strlen(name) + 1 + sizeof(char *);
+
+        if (b->argc > b->base && b->bytes + size > b->max)
+                xbatch_flush(b);
+
+        if (b->argc + 2 > b->cap) {
+                b->cap *= 2;
+                if (!(b->argv = realloc(b->argv, b->cap * sizeof(char *))))
+                        bye("exec: Out of memory");
+        }
+
+        if (!(b->argv[b->argc++] = strdup(name)))
+                bye("exec: Out of memory");
+
+        b->bytes += size;
+}
+
+
+/**
+ * xbatch_flush
+ * ````````````
+ * Run the command for the names in a batch, if there are any.
+ *
+ * @b    : pointer to an open batch
+ * Return: exit status of the command (0 if it was not run).
+ */
+int xbatch_flush(struct xbatch_t *b)
+{
+        struct exec_t x = {};
+        int i;
+
+        if (b->argc == b->base)
+                return 0;
+
+        b->argv[b->argc] = NULL;
+
+        exec_argv(&x, b->argv);
+        fwrite(x.out, 1, x.len, b->out);
+        exec_free(&x);
+
+        if (x.status > b->status)
+                b->status = x.status;
+        b->runs++;
+
+        for (i=b->base; i<b->argc; i++)
+                free(b->argv[i]);
+
+        b->argc  = b->base;
+        b->bytes = 0;
+
+        return x.status;
+}
+
+
+/**
+ * xbatch_close
+ * ````````````
+ * Run the command for whatever is left in a batch, and release it.
+ *
+ * @b    : pointer to an open batch
+ * Return: nothing.
+ */
+void xbatch_close(struct xbatch_t *b)
+{
+        xbatch_flush(b);
+
+        free(b->words);
+        free(b->argv);
+        b->words = NULL;
+        b->argv  = NULL;
+}
+
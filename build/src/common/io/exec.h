@@ -0,0 +1,54 @@
+#ifndef _EXEC_H
+#define _EXEC_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define EXEC_ARGS    (64)          // most words in a command run without a shell
+#define EXEC_BATCH   (128 * 1024)  // most bytes of arguments in one batch
+#define EXEC_SHELL   ("/bin/sh")
+
+
+/* Result of a command
+``````````````````````````````````````````````````````````````````````````````*/
+struct exec_t {
+        char  *out;     // everything the command wrote to stdout (terminated)
+        size_t len;     // bytes in 'out'
+        size_t cap;     // bytes allocated for 'out'
+        int status;     // exit status (128+signal if killed, 127 if not run)
+};
+
+bool  exec_plain(const char *cmd);
+bool  exec_empty(const char *cmd);
+pid_t exec_spawn(char *const argv[], int *fd);
+int   exec_argv (struct exec_t *x, char *const argv[]);
+int   exec_run  (struct exec_t *x, const char *cmd);
+void  exec_free (struct exec_t *x);
+
+
+/* Batches (xargs)
+``````````````````````````````````````````````````````````````````````````````*/
+struct xbatch_t {
+        char  **argv;   // fixed words of the command, then the names
+        int     base;   // number of fixed words
+        int     argc;   // number of words, fixed and names
+        int     cap;    // slots allocated in 'argv'
+        size_t  bytes;  // bytes the names would take in the kernel
+        size_t  max;    // ... and the most they may take
+        char   *words;  // storage for the fixed words
+        FILE   *out;    // where the output of each run goes
+        int     status; // worst exit status of any run
+        long    runs;   // number of times the command was run
+};
+
+void xbatch_open (struct xbatch_t *b, const char *cmd, FILE *out);
+void xbatch_add  (struct xbatch_t *b, const char *name);
+int  xbatch_flush(struct xbatch_t *b);
+void xbatch_close(struct xbatch_t *b);
+
+
+#endif
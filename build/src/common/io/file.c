@@ -304,7 +304,8 @@ bool is_relpath(const char *path)
  */
 void make_path_absolute(char *path)
 {
-        static char buf[PATHSIZE];
+        char cwd[PATHSIZE];
+        char buf[PATHSIZE];
         /*
          * If it's already an absolute path, simply copy 
          * it into the buffer and return.
@@ -316,8 +317,11 @@ void make_path_absolute(char *path)
          * Otherwise, get the current working directory
          * and append the relative path to it.
          */
+        if ((getcwd(cwd, PATHSIZE)) == NULL)
+                bye("Could not stat working directory.");
+
         slcpy(buf, path, PATHSIZE);
-        snprintf(path, PATHSIZE, "%s/%s", scwd(), buf);
+        snprintf(path, PATHSIZE, "%s/%s", cwd, buf);
 }
 
 
@@ -375,8 +379,8 @@ int tempname(char *template)
 
 void srename(const char *oldname, const char *newname)
 {
-        static char old[PATHSIZE];
-        static char new[PATHSIZE];
+        char old[PATHSIZE];
+        char new[PATHSIZE];
 
         slcpy(old, oldname, PATHSIZE);
         slcpy(new, newname, PATHSIZE);
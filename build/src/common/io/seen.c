@@ -0,0 +1,651 @@
+#define USE_ERRNO_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "file.h"
+#include "seen.h"
+#include "../textutils.h"
+#include "../error.h"
+#include "../configfiles.h"
+
+
+/******************************************************************************
+ * SEEN-SETS
+ *
+ * A seen-set remembers which files have already been yielded to a client,
+ * so that repeated scans of a directory only turn up what is new. It used
+ * to be a Bloom filter of filenames, which had three problems:
+ *
+ *      0. False positives. As the filter fills up, new files start to
+ *         look like old ones, and are silently never processed.
+ *
+ *      1. Names are not files. A file replaced under the same name was
+ *         taken for the old one.
+ *
+ *      2. It could be neither reset nor saved, so a restarted pump
+ *         would process the whole directory over again.
+ *
+ * The seen-set is an exact hash table (open addressing, linear probing)
+ * keyed on the (inode, mtime, size) of each file.
+ *
+ * Bounding memory
+ * ---------------
+ *
+ * Each entry is stamped with the generation of the scan in which it was
+ * last seen. After a complete scan of the directory, seen_sweep() drops
+ * every entry that was not seen, since the file it stood for is either
+ * gone or has changed, and opens a new generation. The set is therefore
+ * never much larger than the directory itself, so long as it is swept.
+ *
+ * A pump that is told about new files by a watch never needs to scan the
+ * directory again, and so would never sweep: every file that ever passed
+ * through would stay in the set, and in the checkpoint, until the set was
+ * full. seen_stale() says when enough has been added since the last sweep
+ * that the caller should scan the directory in full, and sweep. That is
+ * once the set has grown by as much as it held after the last sweep, so
+ * the scans cost no more than the adds, and more often when it is close
+ * to full.
+ *
+ * There is also a hard bound, 'max'. A file that does not fit is counted
+ * as a drop and yielded again on the next scan. Better twice than never.
+ *
+ * Checkpoints
+ * -----------
+ *
+ * The set can be checkpointed to a file under CFG_NAME in the directory
+ * being pumped. The checkpoint only ever holds files whose names the
+ * subscriber has acknowledged: a new entry is put in flight by seen_add(),
+ * and appended to the checkpoint when seen_ack() says it was consumed. If
+ * the pump or the subscriber dies with names in flight, they are yielded
+ * again on restart. Better twice than never, here too.
+ *
+ * The checkpoint is rewritten from scratch by seen_save() when a sweep has
+ * made it stale. Loading it is a matter of reading it back.
+ *
+ * Each subscriber has a checkpoint of its own, named by a key it chooses
+ * (see seen_open()), so that two routines pumping the same directory do
+ * not take each other's files for their own. A checkpoint is locked by
+ * the seen-set that has it open; a second subscriber with the same key
+ * gets a seen-set without one, and starts from scratch.
+ *
+ ******************************************************************************/
+
+#define SEEN_MAGIC   (0x4e454553) // "SEEN"
+#define SEEN_VERSION (1)
+#define SEEN_MINCAP  (1024)
+#define SEEN_GEN(e)  ((e)->gen & ~SEEN_FLY)
+
+struct seen_head_t {
+        uint32_t magic;
+        uint32_t version;
+};
+
+
+/**
+ * seen_hash
+ * `````````
+ * Hash the key of an entry.
+ *
+ * @e    : pointer to an entry
+ * Return: 64-bit hash value.
+ *
+ * NOTE
+ * The fields are combined and then run through the 64-bit finalizer
+ * of MurmurHash3, which is plenty for keys that are already numbers.
+ */
+static inline uint64_t seen_hash(const struct seen_ent_t *e)
+{
+        uint64_t h;
+
+        h  = e->ino;
+        h ^= (uint64_t)e->size * 0x9e3779b97f4a7c15ULL;
+        h ^= (uint64_t)e->sec  * 0xc2b2ae3d27d4eb4fULL;
+        h ^= (uint64_t)e->nsec;
+
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+
+        return h;
+}
+
+
+static inline bool seen_same(const struct seen_ent_t *a, const struct seen_ent_t *b)
+{
+        return a->ino  == b->ino
+            && a->size == b->size
+            && a->sec  == b->sec
+            && a->nsec == b->nsec;
+}
+
+
+/**
+ * seen_slot
+ * `````````
+ * Find the slot holding an entry, or the empty slot where it would go.
+ *
+ * @seen : pointer to a seen-set
+ * @key  : entry to look for
+ * Return: pointer to the slot.
+ */
+static struct seen_ent_t *seen_slot(struct seen_t *seen, const struct seen_ent_t *key)
+{
+        size_t mask = seen->cap - 1;
+        size_t i;
+
+        for (i = seen_hash(key) & mask;; i = (i + 1) & mask) {
+                if (seen->tab[i].gen == 0 || seen_same(&seen->tab[i], key))
+                        return &seen->tab[i];
+        }
+}
+
+
+/**
+ * seen_rehash
+ * ```````````
+ * Move the live entries of a seen-set into a table of a new size.
+ *
+ * @seen : pointer to a seen-set
+ * @cap  : new number of slots (a power of 2)
+ * @gen  : only entries of this generation are kept (0 keeps all)
+ * Return: nothing.
+ */
+static void seen_rehash(struct seen_t *seen, size_t cap, uint32_t gen)
+{
+        struct seen_ent_t *old = seen->tab;
+        size_t oldcap = seen->cap;
+        size_t i;
+
+        if (!(seen->tab = calloc(cap, sizeof(struct seen_ent_t))))
+                bye("seen: Out of memory");
+
+        seen->cap  = cap;
+        seen->size = 0;
+
+        for (i=0; i<oldcap; i++) {
+                if (old[i].gen == 0 || (gen && SEEN_GEN(&old[i]) != gen))
+                        continue;
+                *seen_slot(seen, &old[i]) = old[i];
+                seen->size++;
+        }
+
+        free(old);
+}
+
+
+/**
+ * seen_put
+ * ````````
+ * Insert an entry if it is not already present.
+ *
+ * @seen : pointer to a seen-set
+ * @key  : entry to insert
+ * Return: pointer to the entry, or NULL if the set is full.
+ */
+static struct seen_ent_t *seen_put(struct seen_t *seen, const struct seen_ent_t *key)
+{
+        struct seen_ent_t *slot;
+
+        slot = seen_slot(seen, key);
+
+        if (slot->gen != 0)
+                return slot;
+
+        if (seen->size >= seen->max)
+                return NULL;
+
+        /* Keep the load factor under 3/4 */
+        if ((seen->size + 1) * 4 > seen->cap * 3) {
+                seen_rehash(seen, seen->cap * 2, 0);
+                slot = seen_slot(seen, key);
+        }
+
+        *slot     = *key;
+        slot->gen = seen->gen;
+        seen->size++;
+
+        return slot;
+}
+
+
+/**
+ * seen_fly
+ * ````````
+ * Put an entry at the back of the queue of entries in flight.
+ *
+ * @seen : pointer to a seen-set
+ * @key  : the entry
+ * Return: nothing.
+ */
+static void seen_fly(struct seen_t *seen, const struct seen_ent_t *key)
+{
+        struct seen_ent_t *ring;
+        size_t n = seen->flytail - seen->flyhead;
+        size_t cap;
+        size_t i;
+
+        if (n == seen->flycap) {
+                cap = seen->flycap ? seen->flycap * 2 : 256;
+
+                if (!(ring = calloc(cap, sizeof(struct seen_ent_t))))
+                        bye("seen: Out of memory");
+
+                for (i=0; i<n; i++)
+                        ring[i] = seen->fly[(seen->flyhead + i) % seen->flycap];
+
+                free(seen->fly);
+
+                seen->fly     = ring;
+                seen->flycap  = cap;
+                seen->flyhead = 0;
+                seen->flytail = n;
+        }
+
+        seen->fly[seen->flytail++ % seen->flycap] = *key;
+}
+
+
+/**
+ * seen_fopen
+ * ``````````
+ * Open a checkpoint file as a stream, creating it if need be.
+ *
+ * @path  : path of the file
+ * @flags : O_TRUNC to write it afresh, or O_APPEND to add to it
+ * Return: the stream, or NULL (see errno).
+ *
+ * NOTE
+ * fopen() would create the file 0666 less the umask, and the daemon's
+ * umask is whatever it was started with; what a client has seen is
+ * nobody else's business, so the file is made with SEEN_PERMS.
+ */
+static FILE *seen_fopen(const char *path, int flags)
+{
+        FILE *file;
+        int fd;
+
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, SEEN_PERMS)) == -1)
+                return NULL;
+
+        if (!(file = fdopen(fd, (flags & O_APPEND) ? "a" : "w")))
+                close(fd);
+
+        return file;
+}
+
+
+/******************************************************************************
+ * PUBLIC
+ ******************************************************************************/
+
+/**
+ * seen_new
+ * ````````
+ * Allocate an empty seen-set.
+ *
+ * @max  : bound on the number of entries
+ * Return: pointer to a seen-set.
+ */
+struct seen_t *seen_new(size_t max)
+{
+        struct seen_t *seen;
+
+        if (!(seen = calloc(1, sizeof(struct seen_t))))
+                bye("seen: Out of memory");
+
+        seen->max  = max;
+        seen->cap  = SEEN_MINCAP;
+        seen->gen  = 1;
+        seen->lock = -1;
+
+        if (!(seen->tab = calloc(seen->cap, sizeof(struct seen_ent_t))))
+                bye("seen: Out of memory");
+
+        return seen;
+}
+
+
+/**
+ * seen_del
+ * ````````
+ * Free a seen-set, leaving its checkpoint (if any) on disk.
+ *
+ * @seen : pointer to a seen-set
+ * Return: nothing.
+ */
+void seen_del(struct seen_t *seen)
+{
+        if (seen->log)
+                fclose(seen->log);
+
+        if (seen->lock != -1)
+                close(seen->lock); // releases the lock
+
+        free(seen->tab);
+        free(seen->fly);
+        free(seen);
+}
+
+
+/**
+ * seen_reset
+ * ``````````
+ * Forget everything, including what is in the checkpoint.
+ *
+ * @seen : pointer to a seen-set
+ * Return: nothing.
+ */
+void seen_reset(struct seen_t *seen)
+{
+        memset(seen->tab, 0, seen->cap * sizeof(struct seen_ent_t));
+
+        seen->size    = 0;
+        seen->hits    = 0;
+        seen->misses  = 0;
+        seen->fresh   = 0;
+        seen->swept   = 0;
+        seen->drops   = 0;
+        seen->flyhead = 0;
+        seen->flytail = 0;
+
+        if (seen->log)
+                seen_save(seen);
+}
+
+
+/**
+ * seen_add
+ * ````````
+ * Test a file against the seen-set, adding it if it is new.
+ *
+ * @seen : pointer to a seen-set
+ * @st   : stat of the file
+ * Return: true if the file is new, false if it has been seen before.
+ *
+ * NOTE
+ * Either way, the file is marked as seen in the current generation.
+ *
+ * If the set has a checkpoint, a new file is put in flight, and is only
+ * checkpointed once seen_ack() has been told it was consumed. The caller
+ * must acknowledge the new files in the order they were added.
+ */
+bool seen_add(struct seen_t *seen, const struct stat *st)
+{
+        struct seen_ent_t key = {
+                .ino  = st->st_ino,
+                .size = st->st_size,
+                .sec  = st->st_mtim.tv_sec,
+                .nsec = st->st_mtim.tv_nsec,
+        };
+        struct seen_ent_t *ent;
+
+        ent = seen_slot(seen, &key);
+
+        if (ent->gen != 0) {
+                ent->gen = seen->gen | (ent->gen & SEEN_FLY);
+                seen->hits++;
+                return false;
+        }
+
+        seen->misses++;
+        seen->fresh++;
+
+        if (!(ent = seen_put(seen, &key)))
+                seen->drops++;
+
+        /* A drop is in flight too, so that acknowledgements line up */
+        if (seen->log) {
+                if (ent)
+                        ent->gen |= SEEN_FLY;
+                seen_fly(seen, &key);
+        }
+
+        return true;
+}
+
+
+/**
+ * seen_ack
+ * ````````
+ * Checkpoint the oldest files in flight, now that they have been consumed.
+ *
+ * @seen : pointer to a seen-set
+ * @n    : number of files acknowledged by the subscriber
+ * Return: nothing.
+ *
+ * NOTE
+ * A file that was swept (or dropped) while in flight is not checkpointed.
+ */
+void seen_ack(struct seen_t *seen, long n)
+{
+        struct seen_ent_t *ent;
+
+        for (; n > 0 && seen->flyhead < seen->flytail; n--) {
+                ent = seen_slot(seen, &seen->fly[seen->flyhead++ % seen->flycap]);
+
+                if (ent->gen == 0 || !(ent->gen & SEEN_FLY))
+                        continue;
+
+                ent->gen &= ~SEEN_FLY;
+
+                if (seen->log) {
+                        fwrite(ent, sizeof(struct seen_ent_t), 1, seen->log);
+                        seen->logged++;
+                }
+        }
+}
+
+
+/**
+ * seen_sweep
+ * ``````````
+ * Drop the entries not seen in the current generation, and begin another.
+ *
+ * @seen : pointer to a seen-set
+ * Return: nothing.
+ *
+ * CAVEAT
+ * Only call this after a complete scan of the directory, or entries for
+ * files that are still there will be dropped.
+ */
+void seen_sweep(struct seen_t *seen)
+{
+        size_t before = seen->size;
+        size_t cap    = seen->cap;
+
+        /* Shrink the table along with the set */
+        while (cap > SEEN_MINCAP && before * 4 < cap)
+                cap /= 2;
+
+        seen_rehash(seen, cap, seen->gen);
+        seen->gen++;
+
+        seen->fresh = 0;
+        seen->swept = seen->size;
+
+        /* 
+         * The checkpoint is now stale if anything was dropped, and it
+         * may hold entries twice if it was appended to for a long time.
+         */
+        if (seen->log && (seen->size < before || seen->logged > 2 * seen->size))
+                seen_save(seen);
+}
+
+
+/**
+ * seen_stale
+ * ``````````
+ * Check whether a seen-set is due to be swept.
+ *
+ * @seen : pointer to a seen-set
+ * Return: true if the caller should scan the directory in full, and then
+ *         call seen_sweep(), otherwise false.
+ */
+bool seen_stale(struct seen_t *seen)
+{
+        size_t base = (seen->swept > SEEN_MINCAP) ? seen->swept : SEEN_MINCAP;
+
+        if (seen->fresh >= base)
+                return true;
+
+        /* Close to full; don't wait for it to double */
+        return seen->fresh >= SEEN_MINCAP && seen->size >= seen->max - seen->max / 8;
+}
+
+
+/**
+ * seen_open
+ * `````````
+ * Load the checkpoint of a seen-set, and keep it up to date from now on.
+ *
+ * @seen : pointer to an empty seen-set
+ * @dir  : directory whose CFG_NAME subdirectory holds the checkpoint
+ * @key  : names the subscriber the checkpoint belongs to ("" for none)
+ * Return: 1 if the checkpoint is ours, 0 if another seen-set has it open
+ *         (and this one goes without), or -1 if it could not be opened
+ *         at all (see errno).
+ *
+ * NOTE
+ * The key becomes part of a filename, so it should be something like a
+ * hash of the subscriber's routine; anything else is cut short at a '/'
+ * or after SEEN_KEY bytes.
+ */
+int seen_open(struct seen_t *seen, const char *dir, const char *key)
+{
+        struct seen_head_t head;
+        struct seen_ent_t ent;
+        char path[PATHSIZE];
+        FILE *file;
+        int len;
+        int n;
+
+        if (snprintf(path, PATHSIZE, "%s/%s", dir, CFG_NAME) >= PATHSIZE) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+
+        if (mkdir(path, DIR_PERMS) == -1 && errno != EEXIST)
+                return -1;
+
+        len = (int)strcspn(key, "/");
+        len = (len < SEEN_KEY) ? len : SEEN_KEY;
+
+        if (len > 0)
+                n = snprintf(seen->path, PATHSIZE, "%s/%s.%.*s", path, SEEN_NAME, len, key);
+        else
+                n = snprintf(seen->path, PATHSIZE, "%s/%s", path, SEEN_NAME);
+
+        /* The checkpoint is renamed over on every save, so lock beside it */
+        if (n >= PATHSIZE || snprintf(path, PATHSIZE, "%s.lock", seen->path) >= PATHSIZE) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+
+        if ((seen->lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, SEEN_PERMS)) == -1)
+                return -1;
+
+        if (flock(seen->lock, LOCK_EX | LOCK_NB) == -1) {
+                close(seen->lock);
+                seen->lock = -1;
+                return 0;
+        }
+
+        if ((file = fopen(seen->path, "r"))) {
+                if (fread(&head, sizeof(head), 1, file) == 1
+                &&  head.magic   == SEEN_MAGIC
+                &&  head.version == SEEN_VERSION)
+                {
+                        while (fread(&ent, sizeof(ent), 1, file) == 1) {
+                                ent.gen = seen->gen;
+                                seen_put(seen, &ent);
+                        }
+                }
+                sclose(file);
+        }
+
+        /* Rewrite it; this also drops anything torn or unreadable */
+        if (!seen_save(seen)) {
+                close(seen->lock);
+                seen->lock = -1;
+                return -1;
+        }
+
+        return 1;
+}
+
+
+/**
+ * seen_sync
+ * `````````
+ * Flush new entries to the checkpoint.
+ *
+ * @seen : pointer to a seen-set
+ * Return: nothing.
+ */
+void seen_sync(struct seen_t *seen)
+{
+        if (seen->log)
+                fflush(seen->log);
+}
+
+
+/**
+ * seen_save
+ * `````````
+ * Rewrite the checkpoint of a seen-set from scratch.
+ *
+ * @seen : pointer to a seen-set with a checkpoint path
+ * Return: false if the checkpoint could not be written (see errno), in
+ *         which case the set goes on without one, otherwise true.
+ *
+ * NOTE
+ * The checkpoint is written to a temporary file and renamed into place,
+ * so that a crash at any point leaves either the old or the new one.
+ * Files in flight are left out of it.
+ */
+bool seen_save(struct seen_t *seen)
+{
+        struct seen_head_t head = { SEEN_MAGIC, SEEN_VERSION };
+        char temp[PATHSIZE+4];
+        FILE *file;
+        size_t i;
+
+        if (seen->log) {
+                fclose(seen->log);
+                seen->log = NULL;
+        }
+
+        snprintf(temp, PATHSIZE+4, "%s.tmp", seen->path);
+
+        if (!(file = seen_fopen(temp, O_TRUNC)))
+                return false;
+
+        fwrite(&head, sizeof(head), 1, file);
+
+        seen->logged = 0;
+
+        for (i=0; i<seen->cap; i++) {
+                if (seen->tab[i].gen != 0 && !(seen->tab[i].gen & SEEN_FLY)) {
+                        fwrite(&seen->tab[i], sizeof(struct seen_ent_t), 1, file);
+                        seen->logged++;
+                }
+        }
+
+        if (fclose(file) == EOF || rename(temp, seen->path) == -1) {
+                unlink(temp);
+                return false;
+        }
+
+        return (seen->log = seen_fopen(seen->path, O_APPEND)) != NULL;
+}
+
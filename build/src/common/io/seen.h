@@ -0,0 +1,75 @@
+#ifndef _SEEN_SET_H
+#define _SEEN_SET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "file.h"
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define SEEN_MAX   (1 << 20)            // default bound on the number of entries
+#define SEEN_NAME  ("seen")             // checkpoint file, under CFG_NAME
+#define SEEN_KEY   (64)                 // longest subscriber key (see seen_open)
+#define SEEN_FLY   (0x80000000U)        // bit of 'gen': yielded, not yet acknowledged
+#define SEEN_PERMS (S_IRUSR | S_IWUSR)  // mode of the checkpoint files
+
+
+/*
+ * One file, as identified by its inode, mtime and size. A file that is
+ * replaced or rewritten under the same name is a different file.
+ *
+ * While a new file is in flight (yielded, but not yet acknowledged by the
+ * subscriber), SEEN_FLY is set in its 'gen'.
+ */
+struct seen_ent_t {
+        uint64_t ino;
+        int64_t  size;
+        int64_t  sec;
+        int32_t  nsec;
+        uint32_t gen;  // scan generation it was last seen in (0 = empty)
+};
+
+struct seen_t {
+        struct seen_ent_t *tab; // open-addressed hash table
+        size_t cap;             // number of slots (a power of 2)
+        size_t max;             // bound on the number of entries
+        uint32_t gen;           // current scan generation
+        FILE *log;              // checkpoint, if any
+        int lock;               // lock on the checkpoint (-1 if none)
+        char path[PATHSIZE];    // path of the checkpoint
+        size_t logged;          // entries in the checkpoint
+        /* Entries yielded but not acknowledged, oldest first (a ring) */
+        struct seen_ent_t *fly;
+        size_t flyhead;
+        size_t flytail;
+        size_t flycap;
+        /* Counters */
+        unsigned long size;     // entries in the set
+        unsigned long hits;     // files that were already in the set
+        unsigned long misses;   // files that were not
+        unsigned long drops;    // misses that could not be recorded (full)
+        /* Sweeping */
+        size_t fresh;           // misses since the last sweep
+        size_t swept;           // entries left by the last sweep
+};
+
+
+struct seen_t *seen_new  (size_t max);
+void           seen_del  (struct seen_t *seen);
+void           seen_reset(struct seen_t *seen);
+
+bool seen_add  (struct seen_t *seen, const struct stat *st);
+void seen_sweep(struct seen_t *seen);
+bool seen_stale(struct seen_t *seen);
+void seen_ack  (struct seen_t *seen, long n);
+
+int  seen_open (struct seen_t *seen, const char *dir, const char *key);
+void seen_sync (struct seen_t *seen);
+bool seen_save (struct seen_t *seen);
+
+
+#endif
@@ -6,6 +6,7 @@
 #include <stdarg.h>
 
 #include "file.h"
+#include "exec.h"
 #include "../error.h"
 #include "../util.h"
 #include "../textutils.h"
@@ -13,69 +14,81 @@
 /****************************************************************************** 
  * PIPES 
  * 
+ * These used to be built on popen(), and kept only the first line of what
+ * the command printed. They are now built on the exec engine (see exec.c),
+ * which avoids the shell where it can, and keeps everything.
+ *
  ******************************************************************************/
 
 /**
- * shell
- * `````
- * Get the result of command from the shell.
+ * bounce
+ * ``````
+ * Write the result of a shell command to a buffer.
  *
  * @buf  : destination buffer
- * @cmd  : command buffer
- * Return: nothing
+ * @max  : size of destination buffer
+ * @fmt  : format string
+ * @...  : arguments for the format string
+ * Return: 1 if the command printed anything, otherwise 0.
+ *
+ * NOTE
+ * Output longer than 'max' is truncated. The exit status is not looked
+ * at: a command that fails quietly returns 0, and one that prints its
+ * complaint to stdout returns 1. Use exec_run() to get the status.
  */
-static inline int shell(char *buf, const char *cmd)
+int bounce(char *buf, size_t max, const char *fmt, ...)
 {
-        FILE *pipe;
-        int retval;
-
-        /* 
-         * Write the command buffer to the shell and read
-         * the response into the pipe descriptor.
-         */
-        pipe = popen(cmd, "r"); 
-
-        /* 
-         * Scan the contents of the pipe descriptor into
-         * the destination buffer.
-         */
-        if ((fgets(buf, LINESIZE, pipe)) == 0)
-                retval = 0;
-        else
-                retval = 1;
-
-        fclose(pipe);
-
-        return retval;
+        struct exec_t x = {};
+        char cmd[LINESIZE];
+        va_list args;
+        bool printed;
+
+        /* Parse the format string into the command buffer */
+        va_start(args, fmt);
+        vsnprintf(cmd, LINESIZE, fmt, args);
+        va_end(args);
+
+        exec_run(&x, cmd);
+        slcpy(buf, (x.out) ? x.out : "", max);
+        printed = (x.len > 0);
+        exec_free(&x);
+
+        return printed ? 1 : 0;
 }
 
 
 /**
- * bounce
- * ``````
- * Write the result of a shell command to a buffer.
+ * fecho 
+ * `````
+ * Print the result of a shell command to a stream.
  *
- * @buf  : destination buffer
- * @max  : size of destination buffer
+ * @out  : stream to print to
  * @fmt  : format string
  * @...  : arguments for the format string
- * Return: shell return value. 
+ * Return: 1 if the command printed anything, otherwise 0 (see bounce()).
+ *
+ * NOTE
+ * Everything lives on the stack, so that any number of threads may
+ * call fecho() at once, each with its own stream.
  */
-int bounce(char *buf, size_t max, const char *fmt, ...)
+int fecho(FILE *out, const char *fmt, ...)
 {
-        int ret;
+        struct exec_t x = {};
         char cmd[LINESIZE];
         va_list args;
+        bool printed;
 
         /* Parse the format string into the command buffer */
         va_start(args, fmt);
         vsnprintf(cmd, LINESIZE, fmt, args);
         va_end(args);
 
-        if ((ret = shell(buf, cmd)))
-                slcpy(buf, "", max);
+        exec_run(&x, cmd);
+        fwrite(x.out, 1, x.len, out);
+        printed = (x.len > 0);
+        exec_free(&x);
 
-        return ret;
+        return printed ? 1 : 0;
 }
 
 
@@ -86,30 +99,22 @@ int bounce(char *buf, size_t max, const char *fmt, ...)
  *
  * @fmt  : format string
  * @...  : arguments for the format string
- * Return: nothing. 
+ * Return: 1 if the command printed anything, otherwise 0 (see bounce()).
  *
  * NOTE
- * This essentially wraps the bounce() function, but prints the returned
- * buffer contents to stdout, since any echo performed in the bounce pipe
- * will print to the stdout of the forked shell process instead of the
- * caller's process.
+ * This is fecho() to stdout. Any echo performed by the command itself
+ * would print to the stdout of the child process instead of the caller's
+ * process, which is a pipe back to us.
  */
 int echo(const char *fmt, ...)
 {
-        char buf[LINESIZE];
         char cmd[LINESIZE];
         va_list args;
-        int status;
 
         /* Parse the format string into the command buffer */
         va_start(args, fmt);
         vsnprintf(cmd, LINESIZE, fmt, args);
         va_end(args);
 
-        status = shell(buf, cmd);
-        printf("%s", buf);
-
-        return status;
+        return fecho(stdout, "%s", cmd);
 }
-
-
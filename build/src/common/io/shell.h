@@ -1,9 +1,12 @@
 #ifndef _SHELL_H
 #define _SHELL_H
 
+#include <stdio.h>
+
 
 int bounce(char *buf, size_t max, const char *fmt, ...);
 int echo(const char *fmt, ...);
+int fecho(FILE *out, const char *fmt, ...);
 
 
 #endif
@@ -0,0 +1,425 @@
+#define USE_ERRNO_H
+#define _GNU_SOURCE // F_SETLEASE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "../textutils.h"
+#include "../error.h"
+#include "file.h"
+#include "watch.h"
+
+
+/******************************************************************************
+ * DIRECTORY WATCHES
+ *
+ * A watch blocks the caller until there is something new in a directory,
+ * and, whenever it can, tells the caller exactly what the new things are
+ * called, so that the directory need not be scanned again to find out.
+ *
+ * Under Linux this is done with inotify(7). The watch subscribes to three
+ * events on the target directory:
+ *
+ *      IN_CLOSE_WRITE   a file opened for writing was closed
+ *      IN_MOVED_TO      a file was renamed into the directory
+ *      IN_CREATE        a file was created in the directory
+ *
+ * A file that is created and then written will generate IN_CREATE before
+ * its contents are ready, and IN_CLOSE_WRITE once they are. Yielding the
+ * name on IN_CREATE would hand the caller an empty file, so IN_CREATE is
+ * only taken at its word when no IN_CLOSE_WRITE can follow it, which is
+ * when nobody has the file open for writing, e.g. a file published with
+ * link(2) from a temporary name that is then unlinked. The link count
+ * says nothing about this (after the unlink it is 1 again), so we ask the
+ * kernel for a read lease, which it refuses while the file has a writer.
+ *
+ * If the lease cannot be had at all (the file belongs to someone else,
+ * or leases are disabled), we cannot tell, and owe the caller a rescan
+ * WATCH_SETTLE milliseconds later, by which time the file is most likely
+ * done, and would have been yielded on IN_CLOSE_WRITE anyway if not.
+ *
+ * The kernel keeps a bounded queue of events for each inotify instance.
+ * If the consumer falls too far behind, the queue overflows and events
+ * are dropped on the floor, with an IN_Q_OVERFLOW event left behind to
+ * say so. At that point the only safe thing to do is to rescan the whole
+ * directory, and watch_wait() will say as much.
+ *
+ * If inotify is not availible (or the watch cannot be added), the watch
+ * falls back to polling the directory's mtime every 'wait' milliseconds.
+ * The comparison is made on the full timespec, not the one-second time_t,
+ * so that files landing in the same second as the last scan are not lost.
+ * In polling mode every wakeup is a rescan.
+ *
+ ******************************************************************************/
+
+#define WATCH_EVENTS (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+#define EVENT_SIZE(ev) (sizeof(struct inotify_event) + (ev)->len)
+
+
+/**
+ * watch_settle
+ * ````````````
+ * Arrange for a rescan WATCH_SETTLE milliseconds from now.
+ *
+ * @w    : pointer to an open watch
+ * Return: nothing.
+ *
+ * NOTE
+ * A rescan already owed is not put off.
+ */
+static void watch_settle(struct watch_t *w)
+{
+        if (w->settle.tv_sec != 0)
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &w->settle);
+
+        w->settle.tv_sec  += WATCH_SETTLE / 1000;
+        w->settle.tv_nsec += (WATCH_SETTLE % 1000) * 1000000L;
+
+        if (w->settle.tv_nsec >= 1000000000L) {
+                w->settle.tv_nsec -= 1000000000L;
+                w->settle.tv_sec++;
+        }
+}
+
+
+/**
+ * watch_writing
+ * `````````````
+ * Check whether a file in the watched directory is open for writing.
+ *
+ * @w    : pointer to an open watch
+ * @name : name of the file
+ * Return: true if it is, or if we cannot tell (and a rescan is owed),
+ *         otherwise false.
+ *
+ * NOTE
+ * The kernel refuses a read lease on a file that anyone has open for
+ * writing (see fcntl(2), F_SETLEASE). The lease is dropped at once.
+ */
+static bool watch_writing(struct watch_t *w, const char *name)
+{
+        bool writing = false;
+        int fd;
+
+        if ((fd = openat(w->dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY)) == -1) {
+                /* Gone already, or not ours to read; a rescan will tell */
+                if (errno != ENOENT)
+                        watch_settle(w);
+                return true;
+        }
+
+        if (fcntl(fd, F_SETLEASE, F_RDLCK) == 0) {
+                fcntl(fd, F_SETLEASE, F_UNLCK);
+        } else {
+                if (errno != EAGAIN)
+                        watch_settle(w);
+                writing = true;
+        }
+
+        close(fd);
+
+        return writing;
+}
+
+
+/**
+ * watch_open
+ * ``````````
+ * Begin watching a directory.
+ *
+ * @w     : pointer to an uninitialized watch
+ * @dir_fd: open file descriptor of the directory
+ * @path  : path of the same directory
+ * @wait  : polling interval in milliseconds (used only as a fallback)
+ * Return : false if the directory could not be looked at (see errno),
+ *          otherwise true. Being unable to watch it is not a failure;
+ *          the watch polls instead.
+ */
+bool watch_open(struct watch_t *w, int dir_fd, const char *path, long wait)
+{
+        struct stat buf;
+
+        w->dir_fd = dir_fd;
+        w->wait   = (wait < WATCH_MINWAIT) ? WATCH_MINWAIT : wait;
+        w->len    = 0;
+        w->pos    = 0;
+        w->last   = NULL;
+        w->fd     = -1;
+        w->buf    = NULL;
+
+        w->settle.tv_sec  = 0;
+        w->settle.tv_nsec = 0;
+
+        /* Baseline for the polling fallback */
+        if (fstat(dir_fd, &buf) == -1)
+                return false;
+
+        w->mtime = buf.st_mtim;
+
+        if ((w->fd = inotify_init1(IN_CLOEXEC)) == -1)
+                goto polling;
+
+        if ((w->wd = inotify_add_watch(w->fd, path, WATCH_EVENTS)) == -1) {
+                close(w->fd);
+                goto polling;
+        }
+
+        if (!(w->buf = malloc(WATCH_BUFSIZE)))
+                bye("watch: Out of memory");
+
+        return true;
+
+        polling:
+        w->fd  = -1;
+        w->wd  = -1;
+        w->buf = NULL;
+
+        return true;
+}
+
+
+/**
+ * watch_close
+ * ```````````
+ * Stop watching a directory.
+ *
+ * @w    : pointer to an open watch
+ * Return: nothing.
+ *
+ * NOTE
+ * The directory file descriptor belongs to the caller and is left open.
+ */
+void watch_close(struct watch_t *w)
+{
+        if (!watch_polling(w)) {
+                close(w->fd); // releases the watch descriptor as well
+                free(w->buf);
+        }
+        w->fd  = -1;
+        w->buf = NULL;
+}
+
+
+/**
+ * watch_due
+ * `````````
+ * Get the time left until a watch owes its caller a rescan.
+ *
+ * @w    : pointer to an open watch
+ * Return: milliseconds until the rescan (0 if it is due now), or -1 if
+ *         none is owed.
+ */
+long watch_due(struct watch_t *w)
+{
+        struct timespec now;
+        long ms;
+
+        if (w->settle.tv_sec == 0)
+                return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        ms = (w->settle.tv_sec  - now.tv_sec)  * 1000
+           + (w->settle.tv_nsec - now.tv_nsec) / 1000000;
+
+        return (ms < 0) ? 0 : ms;
+}
+
+
+/**
+ * watch_check
+ * ```````````
+ * Check, without waiting, whether the mtime of a watched directory moved,
+ * or whether a rescan owed by the watch has come due.
+ *
+ * @w    : pointer to an open watch
+ * Return: W_RESCAN if it moved or a rescan is due, W_NONE if not, W_ERROR
+ *         if the directory cannot be stat'ed.
+ *
+ * USAGE
+ * For callers with a loop of their own (e.g. around epoll) who want to
+ * poll a directory every w->wait milliseconds without sleeping in here,
+ * or who have been told by watch_due() to come back at a certain time.
+ */
+int watch_check(struct watch_t *w)
+{
+        struct stat buf;
+
+        if (watch_due(w) == 0) {
+                w->settle.tv_sec = 0;
+                return W_RESCAN;
+        }
+
+        if (!watch_polling(w))
+                return W_NONE;
+
+        if (fstat(w->dir_fd, &buf) == -1)
+                return W_ERROR;
+
+        if (buf.st_mtim.tv_sec  == w->mtime.tv_sec
+        &&  buf.st_mtim.tv_nsec == w->mtime.tv_nsec)
+                return W_NONE;
+
+        /*
+         * Record the new mtime before the caller rescans, so that
+         * anything arriving during the scan moves it again.
+         */
+        w->mtime = buf.st_mtim;
+
+        return W_RESCAN;
+}
+
+
+/**
+ * watch_poll
+ * ``````````
+ * Sleep until the mtime of the watched directory changes.
+ *
+ * @w    : pointer to an open watch in polling mode
+ * Return: W_RESCAN, or W_ERROR if the directory cannot be stat'ed.
+ */
+static int watch_poll(struct watch_t *w)
+{
+        int status;
+
+        do {
+                poll(NULL, 0, w->wait);
+        } while ((status = watch_check(w)) == W_NONE);
+
+        return status;
+}
+
+
+/**
+ * watch_wait
+ * ``````````
+ * Block until there is something new in the watched directory.
+ *
+ * @w    : pointer to an open watch
+ * Return: W_NAMES, W_RESCAN or W_ERROR (see watch.h).
+ *
+ * USAGE
+ * When W_NAMES is returned, the new names are drained with watch_next().
+ * When W_RESCAN is returned, the caller must scan the entire directory.
+ *
+ * If watch_fd() is readable, or a rescan is due (see watch_due()), this
+ * will not block.
+ */
+int watch_wait(struct watch_t *w)
+{
+        struct inotify_event *ev;
+        struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+        ssize_t i;
+
+        if (watch_polling(w))
+                return watch_poll(w);
+
+        w->pos  = 0;
+        w->last = NULL;
+        w->len  = 0;
+
+        /* Sleep no longer than the rescan we owe */
+        while (watch_due(w) != -1) {
+                if (poll(&pfd, 1, (int)watch_due(w)) > 0)
+                        break;
+                if (watch_check(w) == W_RESCAN)
+                        return W_RESCAN;
+        }
+
+        while ((w->len = read(w->fd, w->buf, WATCH_BUFSIZE)) == -1) {
+                if (errno != EINTR)
+                        return W_ERROR;
+        }
+
+        /*
+         * If the kernel queue overflowed, or the watch was removed
+         * out from under us, the names we have are not the whole
+         * story; throw them away and tell the caller to rescan.
+         */
+        for (i=0; i<w->len; i+=EVENT_SIZE(ev)) {
+                ev = (struct inotify_event *)&w->buf[i];
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                        w->len = 0;
+                        w->settle.tv_sec = 0; // the rescan covers it
+                        return W_RESCAN;
+                }
+                if (ev->mask & IN_IGNORED) {
+                        watch_close(w);
+                        return W_RESCAN; // fall back to polling
+                }
+        }
+
+        return W_NAMES;
+}
+
+
+/**
+ * watch_next
+ * ``````````
+ * Yield the names queued by the last call to watch_wait().
+ *
+ * @w     : pointer to an open watch
+ * @filter: file type to yield (see note on file predicates in file.h)
+ * Return : the next new name, or NULL when the queue is drained.
+ *
+ * NOTES
+ * The stat of each yielded name (following symlinks) is left in w->st
+ * for the caller. The same name will often appear several times in one
+ * batch (e.g. a file written through several open/close cycles);
+ * consecutive repeats are yielded only once.
+ */
+const char *watch_next(struct watch_t *w, int filter)
+{
+        struct inotify_event *ev;
+
+        while (w->pos < w->len) {
+                ev      = (struct inotify_event *)&w->buf[w->pos];
+                w->pos += EVENT_SIZE(ev);
+
+                if (ev->len == 0 || (ev->mask & IN_ISDIR))
+                        continue;
+
+                /* Hidden files are not yielded (see diterate) */
+                if (ev->name[0] == '.')
+                        continue;
+
+                if (w->last && STRCMP(w->last, ev->name))
+                        continue;
+
+                /*
+                 * The file may already be gone. Symlinks are followed,
+                 * as they are by a rescan (see diter_stat()), so that a
+                 * link has the same type and seen-set key either way.
+                 */
+                if (fstatat(w->dir_fd, ev->name, &w->st, 0))
+                        continue;
+
+                if (F_TYPE(w->st.st_mode) != filter)
+                        continue;
+
+                /*
+                 * A bare IN_CREATE is followed by IN_CLOSE_WRITE if the
+                 * file is still open for writing; if not (e.g. it was
+                 * linked into place), this is the only event we get.
+                 */
+                if ((ev->mask & IN_CREATE) && watch_writing(w, ev->name))
+                        continue;
+
+                return (w->last = ev->name);
+        }
+
+        return NULL;
+}
+
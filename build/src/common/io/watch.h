@@ -0,0 +1,59 @@
+#ifndef _DIR_WATCH_H
+#define _DIR_WATCH_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define WATCH_BUFSIZE (64 * 1024) // Bytes of inotify events read at once
+#define WATCH_MINWAIT (100)       // Shortest polling interval (milliseconds)
+#define WATCH_SETTLE  (1000)      // Rescan this long after an unexplained IN_CREATE (ms)
+
+
+/* Values returned by watch_wait()
+``````````````````````````````````````````````````````````````````````````````*/
+#define W_ERROR  -1 // The watch is unusable
+#define W_NONE    0 // Nothing new (watch_check() only)
+#define W_NAMES   1 // New names are queued, drain them with watch_next()
+#define W_RESCAN  2 // Events were lost (or we are polling); rescan everything
+
+
+struct watch_t {
+        int  fd;               // inotify instance, or -1 if polling
+        int  wd;               // watch descriptor on the target
+        int  dir_fd;           // directory being watched
+        long wait;             // polling interval (milliseconds)
+        struct timespec mtime; // last directory mtime seen while polling
+        struct timespec settle;// when a rescan is owed (zero if none is)
+        struct stat st;        // stat of the name last yielded
+        char *buf;             // raw inotify event buffer
+        ssize_t len;           // number of bytes of events in 'buf'
+        ssize_t pos;           // cursor into 'buf' used by watch_next()
+        const char *last;      // name last yielded by watch_next()
+};
+
+
+bool        watch_open (struct watch_t *w, int dir_fd, const char *path, long wait);
+void        watch_close(struct watch_t *w);
+int         watch_wait (struct watch_t *w);
+int         watch_check(struct watch_t *w);
+long        watch_due  (struct watch_t *w);
+const char *watch_next (struct watch_t *w, int filter);
+
+static inline bool watch_polling(struct watch_t *w)
+{
+        return (w->fd == -1);
+}
+
+/* Readable when watch_wait() has something to say; -1 when polling */
+static inline int watch_fd(struct watch_t *w)
+{
+        return w->fd;
+}
+
+
+#endif
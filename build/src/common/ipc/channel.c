@@ -3,10 +3,13 @@
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/ipc.h>
 #include <stdarg.h>
+#include <errno.h>
 
 #include "../io/file.h"
 #include "../error.h"
@@ -71,6 +74,14 @@
  * appropriate way. We're going with the latter option, although
  * no-delay is supported (see dpx_open()).
  *
+ * A publisher opened with CH_NIO takes the former. It opens the read
+ * end O_NONBLOCK and the write end O_RDWR | O_NONBLOCK, neither of which
+ * waits for the other side, so the channel is ready to be handed to a
+ * subscriber as soon as dpx_open() returns. This is what lets a single
+ * process serve many channels from one epoll loop (see pumps.c); the
+ * catch is that reads on such a channel must be prepared to find nothing
+ * there, and writes to find no room (see NON-BLOCKING PUBLISHERS).
+ *
  * "Keep-alive"
  * ------------
  *
@@ -155,6 +166,15 @@ void dpx_open(struct dpx_t *dpx, const char *path, int mode)
         /* Set the path of the channel's disk files */
         dpx->path = sdup(path);
 
+        /* Nothing framed in either direction yet */
+        dpx->out    = NULL;
+        dpx->in     = NULL;
+        dpx->outlen = 0;
+        dpx->inpos  = 0;
+        dpx->inlen  = 0;
+        dpx->credit = DPX_CREDIT;
+        dpx->owed   = 0;
+
         /* Open the file descriptors in the appropriate order */
         if (dpx->role == PUBLISH) {
                 /* Set the publish and subscribe paths */
@@ -162,9 +182,15 @@ void dpx_open(struct dpx_t *dpx, const char *path, int mode)
                 dpx->path_sub = sdup(concat(path, "/sub"));
 
                 /* Open the publish and subscribe paths */ 
-                dpx->fd_sub = fifo_open(dpx->path_sub, O_RDONLY);
-                dpx->fd_nub = fifo_open(dpx->path_sub, O_WRONLY);
-                dpx->fd_pub = fifo_open(dpx->path_pub, O_WRONLY); // keepalive
+                if (mode & CH_NIO) {
+                        dpx->fd_sub = fifo_open(dpx->path_sub, O_RDONLY | O_NONBLOCK);
+                        dpx->fd_nub = fifo_open(dpx->path_sub, O_WRONLY); // keepalive
+                        dpx->fd_pub = fifo_open(dpx->path_pub, O_RDWR | O_NONBLOCK);
+                } else {
+                        dpx->fd_sub = fifo_open(dpx->path_sub, O_RDONLY);
+                        dpx->fd_nub = fifo_open(dpx->path_sub, O_WRONLY);
+                        dpx->fd_pub = fifo_open(dpx->path_pub, O_WRONLY); // keepalive
+                }
 
         } else if (dpx->role == SUBSCRIBE) {
                 /* Set the publish and subscribe paths */ 
@@ -193,7 +219,8 @@ void dpx_close(struct dpx_t *dpx)
 {
         if (dpx->role == PUBLISH) {
                 close(dpx->fd_sub);
-                close(dpx->fd_nub);
+                if (dpx->fd_nub != -1)
+                        close(dpx->fd_nub);
                 close(dpx->fd_pub);
         } else if (dpx->role == SUBSCRIBE) {
                 close(dpx->fd_pub);
@@ -201,6 +228,11 @@ void dpx_close(struct dpx_t *dpx)
         } else {
                 bye("close_dpx: Invalid duplex role");
         }
+
+        free(dpx->out);
+        free(dpx->in);
+        dpx->out = NULL;
+        dpx->in  = NULL;
 }
 
 
@@ -410,3 +442,501 @@ void dpx_kill(struct dpx_t *dpx, int signo)
         kill(dpx->remote_pid, signo);
 }
 
+
+
+/******************************************************************************
+ * FRAMES 
+ *
+ * The transmission calls above move one message per MIN_PIPESIZE block,
+ * which is fine for the odd handshake or control message, but wasteful
+ * for a stream of filenames: every 30-byte name costs a 4 KB write, a
+ * 4 KB read, and a pair of system calls.
+ *
+ * Once a channel is linked, the publisher can instead pack messages into
+ * frames, each of which is a 4-byte header followed by the message bytes:
+ *
+ *       31      24 23                     0
+ *      +----------+------------------------+-----------------------+
+ *      |   type   |         length         |  message (length) ... |
+ *      +----------+------------------------+-----------------------+
+ *
+ * Frames are appended to an output batch by dpx_put(), and the batch goes 
+ * out in a single write when it fills up or when dpx_push() is called. 
+ * On the other end, dpx_next() reads as much as the FIFO will give it and 
+ * hands back one frame at a time, holding on to any partial frame until 
+ * the rest of it arrives.
+ *
+ * Flow control
+ * ------------
+ *
+ * In place of the old DONE/ack lockstep, the publisher is given credit 
+ * for DPX_CREDIT DATA frames when the channel is opened, and spends one 
+ * for each frame it puts. The subscriber returns credit with a CREDIT 
+ * frame once it has consumed half a window's worth. A publisher with no 
+ * credit left pushes what it has and waits for more.
+ *
+ * Since the subscriber only hands back credit for frames it has consumed,
+ * CREDIT frames double as acknowledgements. Credit bounds the number of
+ * frames in flight, not the bytes: DPX_CREDIT frames of short names fit
+ * in a FIFO, but DPX_CREDIT frames near PATHSIZE do not, nor do a few
+ * dozen in a FIFO shrunk by pipe-user-pages-soft. A blocking publisher
+ * then waits in write() for the subscriber to read, which costs it
+ * nothing but time. A CH_NIO publisher can not afford to, so dpx_push()
+ * keeps what did not fit in the batch, and dpx_put() says when the batch
+ * is full too (see dpx_push()).
+ *
+ * dpx_put   -- add a DATA frame to the output batch
+ * dpx_push  -- write the output batch to the channel
+ * dpx_next  -- read the next DATA frame into the transmission buffer
+ * dpx_grant -- send a CREDIT frame
+ *
+ * Errors
+ * ------
+ *
+ * None of these exit. A frame that makes no sense, a subscriber that
+ * sends data, or a read or write that fails is reported as FR_ERROR (or
+ * -1), and what to do about it is up to the caller: a pump of its own
+ * can give up, but a daemon serving many channels only drops the one.
+ *
+ ******************************************************************************/
+
+
+/**
+ * dpx_frame
+ * `````````
+ * Append a frame to the output batch.
+ *
+ * @dpx  : pointer to a duplex structure
+ * @type : frame type
+ * @msg  : frame payload
+ * @len  : length of the payload
+ * Return: 0, or -1 if the batch had to be written and could not be, or
+ *         (with errno EAGAIN) could not all be, and the frame won't fit.
+ */
+static int dpx_frame(struct dpx_t *dpx, int type, const void *msg, size_t len)
+{
+        uint32_t head;
+
+        if (!dpx->out && !(dpx->out = malloc(DPX_BATCH)))
+                bye("dpx_frame: Out of memory");
+
+        if (dpx->outlen + FR_HEAD + len > DPX_BATCH) {
+                if (dpx_push(dpx) == -1)
+                        return -1;
+                if (dpx->outlen + FR_HEAD + len > DPX_BATCH) {
+                        errno = EAGAIN;
+                        return -1;
+                }
+        }
+
+        head = FR_PACK(type, len);
+
+        memcpy(dpx->out + dpx->outlen, &head, FR_HEAD);
+        memcpy(dpx->out + dpx->outlen + FR_HEAD, msg, len);
+
+        dpx->outlen += FR_HEAD + len;
+
+        return 0;
+}
+
+
+/**
+ * dpx_fill
+ * ````````
+ * Read from the channel until at least one whole frame is buffered.
+ *
+ * @dpx  : pointer to a duplex structure
+ * @head : filled with the header of the frame
+ * Return: 1 if there is a frame, 0 if the other end hung up, -1 if the
+ *         channel is non-blocking and there is nothing more to read, or
+ *         -2 if the frame can never fit or the read failed.
+ */
+static int dpx_fill(struct dpx_t *dpx, uint32_t *head)
+{
+        size_t have;
+        ssize_t z;
+
+        if (!dpx->in && !(dpx->in = malloc(DPX_BATCH)))
+                bye("dpx_fill: Out of memory");
+
+        for (;;) {
+                have = dpx->inlen - dpx->inpos;
+
+                if (have >= FR_HEAD) {
+                        memcpy(head, dpx->in + dpx->inpos, FR_HEAD);
+                        if (have >= FR_HEAD + FR_LEN(*head))
+                                return 1;
+                        if (FR_HEAD + FR_LEN(*head) > DPX_BATCH)
+                                return -2;
+                }
+
+                /* Partial frame; slide it to the front and read more */
+                memmove(dpx->in, dpx->in + dpx->inpos, have);
+                dpx->inpos = 0;
+                dpx->inlen = have;
+
+                z = read(dpx->fd_sub, dpx->in + have, DPX_BATCH - have);
+
+                if (z == 0)
+                        return 0;
+                if (z == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                return -1;
+                        return -2;
+                }
+
+                dpx->inlen += z;
+        }
+}
+
+
+/**
+ * dpx_take
+ * ````````
+ * Consume the next frame, whatever its type.
+ *
+ * @dpx  : pointer to a duplex structure
+ * Return: the frame type, FR_NONE if the other end hung up, FR_WAIT if
+ *         the channel is non-blocking and no whole frame is in yet, or
+ *         FR_ERROR if the frame is malformed or could not be read.
+ *
+ * NOTES
+ * The payload of a DATA frame is copied into the transmission buffer
+ * (and NUL-terminated), so that it can be used like any other message. 
+ * CREDIT frames are applied to the channel's credit on the spot.
+ */
+static int dpx_take(struct dpx_t *dpx)
+{
+        uint32_t head;
+        uint32_t n;
+        size_t len;
+
+        switch (dpx_fill(dpx, &head)) {
+        case 0:
+                return FR_NONE;
+        case -1:
+                return FR_WAIT;
+        case -2:
+                return FR_ERROR;
+        }
+
+        len = FR_LEN(head);
+
+        dpx->inpos += FR_HEAD;
+
+        switch (FR_TYPE(head)) {
+        case FR_DATA:
+                dpx->len = (len < MIN_PIPESIZE) ? len : MIN_PIPESIZE-1;
+                memcpy(dpx->buf, dpx->in + dpx->inpos, dpx->len);
+                dpx->buf[dpx->len] = '\0';
+                break;
+        case FR_CREDIT:
+                memcpy(&n, dpx->in + dpx->inpos, sizeof(n));
+                dpx->credit += n;
+                break;
+        default:
+                /* Can't tell where the next frame starts, if there is one */
+                return FR_ERROR;
+        }
+
+        dpx->inpos += len;
+
+        return FR_TYPE(head);
+}
+
+
+/**
+ * dpx_push
+ * ````````
+ * Write the output batch to the channel.
+ *
+ * @dpx  : pointer to a duplex structure
+ * Return: 0, or -1 if the write failed (see errno).
+ *
+ * NOTE
+ * On a CH_NIO channel, the FIFO may have less room than the batch. What
+ * does not fit stays at the front of the batch for the next push, and
+ * this still returns 0, so check dpx->outlen to see if anything is left.
+ * The caller should push again once the FIFO is writable, e.g. when the
+ * subscriber returns credit, or on EPOLLOUT.
+ */
+int dpx_push(struct dpx_t *dpx)
+{
+        size_t done = 0;
+        ssize_t z;
+
+        while (done < dpx->outlen) {
+                z = write(dpx->fd_pub, dpx->out + done, dpx->outlen - done);
+
+                if (z == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                break;
+                        return -1;
+                }
+                done += z;
+        }
+
+        if (done > 0) {
+                memmove(dpx->out, dpx->out + done, dpx->outlen - done);
+                dpx->outlen -= done;
+        }
+
+        return 0;
+}
+
+
+/**
+ * dpx_put
+ * ```````
+ * Add a message to the output batch as a DATA frame.
+ *
+ * @dpx  : pointer to a duplex structure
+ * @msg  : message to be sent
+ * Return: 0, or -1 if the subscriber hung up while we waited for credit,
+ *         or the channel broke, or (with errno EAGAIN) the FIFO and the
+ *         batch are both full.
+ *
+ * NOTE
+ * The message is not necessarily written when this returns. Call
+ * dpx_push() before waiting on anything other than the channel.
+ *
+ * On EAGAIN, which only a CH_NIO channel can see, the message was not
+ * taken and no credit was spent; put it again once there is room.
+ *
+ * CAVEAT
+ * Out of credit, this waits for the subscriber. On a CH_NIO channel
+ * that means spinning, so check dpx->credit before calling it there.
+ */
+int dpx_put(struct dpx_t *dpx, const char *msg)
+{
+        /* Out of credit; flush and wait for the subscriber */
+        if (dpx->credit <= 0) {
+                if (dpx_push(dpx) == -1)
+                        return -1;
+
+                while (dpx->credit <= 0) {
+                        if (dpx_take(dpx) != FR_CREDIT)
+                                return -1;
+                }
+        }
+
+        if (dpx_frame(dpx, FR_DATA, msg, strnlen(msg, MIN_PIPESIZE-1)) == -1)
+                return -1;
+
+        dpx->credit--;
+
+        return 0;
+}
+
+
+/**
+ * dpx_grant
+ * `````````
+ * Return credit to the publisher.
+ *
+ * @dpx  : pointer to a duplex structure
+ * @n    : number of DATA frames the publisher may send
+ * Return: 0, or -1 if it could not be written.
+ */
+int dpx_grant(struct dpx_t *dpx, long n)
+{
+        uint32_t credit = (uint32_t)n;
+
+        if (dpx_frame(dpx, FR_CREDIT, &credit, sizeof(credit)) == -1)
+                return -1;
+
+        return dpx_push(dpx);
+}
+
+
+/**
+ * dpx_ready
+ * `````````
+ * Check whether dpx_next() would return without waiting.
+ *
+ * @dpx  : pointer to a duplex structure
+ * Return: true if a whole frame is buffered, or more has arrived (or
+ *         the other end hung up), otherwise false.
+ */
+bool dpx_ready(struct dpx_t *dpx)
+{
+        struct pollfd pfd = { .fd = dpx->fd_sub, .events = POLLIN };
+        size_t have = dpx->inlen - dpx->inpos;
+        uint32_t head;
+
+        if (have >= FR_HEAD) {
+                memcpy(&head, dpx->in + dpx->inpos, FR_HEAD);
+                if (have >= FR_HEAD + FR_LEN(head))
+                        return true;
+        }
+
+        return poll(&pfd, 1, 0) > 0;
+}
+
+
+/**
+ * dpx_next
+ * ````````
+ * Read the next message from the channel into the transmission buffer.
+ *
+ * @dpx  : pointer to a duplex structure
+ * Return: FR_DATA, FR_NONE if the other end hung up, or FR_ERROR if the
+ *         channel broke.
+ *
+ * USAGE
+ * Reading a message tells the publisher that the one before it has
+ * been dealt with, so the subscriber's loop should look like
+ *
+ *      while (dpx_next(&dpx) == FR_DATA) {
+ *              ...do something with dpx.buf
+ *      }
+ *
+ * NOTE
+ * Credit is returned in bulk, but also whenever we are about to wait,
+ * so that a publisher who checkpoints what has been acknowledged is not
+ * left behind by a quiet channel.
+ */
+int dpx_next(struct dpx_t *dpx)
+{
+        int type;
+
+        if (dpx->owed >= DPX_CREDIT/2 || (dpx->owed > 0 && !dpx_ready(dpx))) {
+                if (dpx_grant(dpx, dpx->owed) == -1)
+                        return FR_ERROR;
+                dpx->owed = 0;
+        }
+
+        while ((type = dpx_take(dpx)) == FR_CREDIT)
+                ;
+
+        if (type == FR_DATA)
+                dpx->owed++;
+
+        return type;
+}
+
+
+/******************************************************************************
+ * NON-BLOCKING PUBLISHERS
+ *
+ * A publisher opened with CH_NIO is driven by readiness events, so the
+ * calls it makes on the channel must never block. These take whatever
+ * is there, or write whatever fits, and report how it went.
+ *
+ * dpx_tryread -- read a message block, if one has arrived
+ * dpx_trysend -- write a message block, if there is room
+ * dpx_credit  -- apply any CREDIT frames that have arrived
+ * dpx_unkeep  -- drop the keepalive, so a hangup can be seen
+ *
+ ******************************************************************************/
+
+/**
+ * dpx_tryread
+ * ```````````
+ * Read a message block into the transmission buffer, if there is one.
+ *
+ * @dpx  : pointer to a duplex structure (CH_NIO)
+ * Return: 1 if a message was read, 0 if the other end hung up, or -1 if
+ *         there is nothing to read yet.
+ *
+ * NOTE
+ * Message blocks are MIN_PIPESIZE bytes, under PIPE_BUF, so they are
+ * written and read whole.
+ */
+int dpx_tryread(struct dpx_t *dpx)
+{
+        char buf[MIN_PIPESIZE + 1];
+        ssize_t z;
+
+        while ((z = read(dpx->fd_sub, buf, MIN_PIPESIZE)) == -1) {
+                if (errno == EAGAIN)
+                        return -1;
+                if (errno != EINTR)
+                        bye("dpx_tryread: Could not read from channel");
+        }
+
+        if (z == 0)
+                return 0;
+
+        buf[z] = '\0';
+        slcpy(dpx->buf, buf, MIN_PIPESIZE);
+
+        return 1;
+}
+
+
+/**
+ * dpx_trysend
+ * ```````````
+ * Load and write the transmission buffer, if the FIFO has room for it.
+ *
+ * @dpx  : pointer to a duplex structure (CH_NIO)
+ * @msg  : message to be loaded into the duplex
+ * Return: 0 if the message was written, or -1 if it was not (see errno;
+ *         EAGAIN if the FIFO is full).
+ *
+ * NOTE
+ * Like dpx_tryread(), this relies on the block being under PIPE_BUF: it
+ * goes into the FIFO whole or not at all.
+ */
+int dpx_trysend(struct dpx_t *dpx, const char *msg)
+{
+        dpx_load(dpx, msg);
+
+        while (write(dpx->fd_pub, dpx->buf, MIN_PIPESIZE) == -1) {
+                if (errno != EINTR)
+                        return -1;
+        }
+
+        return 0;
+}
+
+
+/**
+ * dpx_credit
+ * ``````````
+ * Apply the CREDIT frames that have arrived from the subscriber.
+ *
+ * @dpx  : pointer to a duplex structure (CH_NIO)
+ * Return: FR_NONE if the subscriber hung up, FR_ERROR if it sent anything
+ *         but credit, otherwise FR_WAIT.
+ */
+int dpx_credit(struct dpx_t *dpx)
+{
+        int type;
+
+        while ((type = dpx_take(dpx)) == FR_CREDIT)
+                ;
+
+        if (type == FR_DATA)
+                return FR_ERROR;
+
+        return type;
+}
+
+
+/**
+ * dpx_unkeep
+ * ``````````
+ * Close the keepalive descriptor of a publisher.
+ *
+ * @dpx  : pointer to a duplex structure
+ * Return: nothing.
+ *
+ * NOTE
+ * While the publisher holds the write end of its own read FIFO, reads
+ * never return end-of-file, so it can never tell that the subscriber has
+ * gone. Once the subscriber has connected, a publisher serving just the
+ * one subscriber can let go of it.
+ */
+void dpx_unkeep(struct dpx_t *dpx)
+{
+        if (dpx->fd_nub != -1) {
+                close(dpx->fd_nub);
+                dpx->fd_nub = -1;
+        }
+}
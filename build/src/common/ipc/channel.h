@@ -2,11 +2,22 @@
 #define _IPC_CHANNELS_H 
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define MIN_PIPESIZE (4095) // 4096 - 1
 #define MAX_PATHSIZE (255)
 
+#define DPX_BATCH  (16 * 1024) // bytes of frames coalesced into one write
+#define DPX_CREDIT (128)       // frames a publisher may have in flight
+
+/* Frame types (see "FRAMES" in channel.c) */
+#define FR_NONE   0x00 // no frame, the other end hung up
+#define FR_DATA   0x01 // a message 
+#define FR_CREDIT 0x02 // permission to send more DATA frames
+#define FR_WAIT   0x03 // no whole frame yet (non-blocking channels only)
+#define FR_ERROR  0x04 // the channel is broken: a bad frame, or I/O failed
+
 enum dpx_role { 
         PUBLISH, 
         SUBSCRIBE 
@@ -22,11 +33,26 @@ struct dpx_t {
         char *path_sub;
         char *path;
         pid_t remote_pid;
+        /* Framed transmission */
+        char   *out;    // frames waiting to be written
+        size_t  outlen; // bytes waiting in 'out'
+        char   *in;     // bytes read but not yet consumed
+        size_t  inpos;  // start of the unconsumed bytes in 'in'
+        size_t  inlen;  // end of the unconsumed bytes in 'in'
+        size_t  len;    // length of the message in 'buf'
+        long    credit; // DATA frames we may still send
+        long    owed;   // DATA frames consumed but not yet credited
 };
 
+#define FR_HEAD       (sizeof(uint32_t))
+#define FR_PACK(t, n) ((uint32_t)(t) << 24 | (uint32_t)(n))
+#define FR_TYPE(h)    ((h) >> 24)
+#define FR_LEN(h)     ((h) & 0x00ffffff)
+
 #define CH_NEW 0x001
 #define CH_PUB 0x002
 #define CH_SUB 0x000
+#define CH_NIO 0x004 // publisher only; open without waiting for the subscriber
 #define CH_ROLE(mode) (((mode) & CH_PUB) == CH_PUB) ? PUBLISH : SUBSCRIBE
 #define NEW_CH(mode)  (((mode) & CH_NEW) == CH_NEW) ? true : false
 
@@ -51,6 +77,17 @@ void dpx_load  (struct dpx_t *dpx, const char *msg);
 void dpx_flush (struct dpx_t *dpx);
 void dpx_kill  (struct dpx_t *dpx, int signo);
 
+int  dpx_put   (struct dpx_t *dpx, const char *msg);
+int  dpx_push  (struct dpx_t *dpx);
+int  dpx_next  (struct dpx_t *dpx);
+bool dpx_ready (struct dpx_t *dpx);
+int  dpx_grant (struct dpx_t *dpx, long n);
+
+int  dpx_tryread(struct dpx_t *dpx);
+int  dpx_trysend(struct dpx_t *dpx, const char *msg);
+int  dpx_credit (struct dpx_t *dpx);
+void dpx_unkeep (struct dpx_t *dpx);
+
 
 static inline void dpx_olink(struct dpx_t *dpx, const char *path, int mode)
 { 
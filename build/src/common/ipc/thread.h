@@ -8,6 +8,7 @@ typedef pthread_t           pth_thread;
 typedef pthread_attr_t      pth_attr;
 typedef pthread_mutex_t     pth_mutex;
 typedef pthread_mutexattr_t pth_mutex_attr;
+typedef pthread_cond_t      pth_cond;
 
 
 struct pth_t {
@@ -41,6 +42,12 @@ static inline void pth_exit(struct pth_t *pth, void *retval)
 }
 
 
+static inline void pth_join(struct pth_t *pth, void **retval)
+{
+        pthread_join(pth->thread, retval);
+}
+
+
 
 
 static inline int pth_lock(pth_mutex *mutex) 
@@ -60,4 +67,28 @@ static inline int pth_trylock(pth_mutex *mutex)
 }
 
 
+
+
+static inline void pth_cond_init(pth_cond *cond)
+{
+        pthread_cond_init(cond, NULL);
+}
+
+/* Call with 'mutex' held */
+static inline int pth_wait(pth_cond *cond, pth_mutex *mutex)
+{
+        return pthread_cond_wait(cond, mutex);
+}
+
+static inline int pth_signal(pth_cond *cond)
+{
+        return pthread_cond_signal(cond);
+}
+
+static inline int pth_broadcast(pth_cond *cond)
+{
+        return pthread_cond_broadcast(cond);
+}
+
+
 #endif
@@ -107,65 +107,242 @@
  ******************************************************************************/
 
 #include <limits.h>
-#include <stdarg.h>
-#include <stdbool.h>
+#include <string.h>
+#include <math.h>
 
 #include "bloom.h"
 
 
-#define SETBIT(a,n) (a[n/CHAR_BIT] |= (1<<(n%CHAR_BIT)))
-#define GETBIT(a,n) (a[n/CHAR_BIT] &  (1<<(n%CHAR_BIT)))
-#define ROUND(size) ((size + CHAR_BIT - 1) / CHAR_BIT)
+/******************************************************************************
+ * BLOCKED BLOOM FILTERS
+ *
+ * The classic filter above hashes the key k times, with k different hash
+ * functions, and each of the k bits it lands on is in a random place in
+ * the array. For a filter much bigger than the cache, that is k passes
+ * over the key and k cache misses per lookup.
+ *
+ * This one hashes the key once, to 64 bits, and uses the hash to choose a
+ * block of BLOOM_BLOCK bytes (one cache line, 512 bits). All k bits for
+ * the key are in that block, at positions made from the same hash by
+ * double hashing:
+ *
+ *      bit(i) = (h1 + i*h2) mod 512,    i = 0 .. k-1
+ *
+ * where h1 and h2 are two halves of a remix of the hash, and h2 is odd.
+ * An odd stride is invertible mod 512, so no two probes of one key land
+ * on the same bit. A lookup is then one pass over the key and one miss.
+ *
+ * Sizing
+ * ------
+ *
+ * The filter is sized from the number of keys n it must hold, and the
+ * false positive rate p it should have with that many, using the two
+ * results in the NOTES above:
+ *
+ *      m = -((n*ln(p)) / ((ln(2))^2)),    k = (m/n)ln(2)
+ *
+ * and m is rounded up to a whole number of blocks.
+ *
+ * CAVEAT
+ * Confining a key to one block makes the fill of the blocks uneven, and
+ * the false positive rate comes out somewhat above p, more so for small
+ * p; see "bench bloom". Size with a smaller p if it matters.
+ *
+ * Union and intersection
+ * ----------------------
+ *
+ * Two filters of the same shape (m and k) can be merged with OR, and the
+ * result is the filter of the union of their sets. AND gives a filter that
+ * answers for the intersection, though with a higher false positive rate
+ * than a filter built from the intersection directly.
+ *
+ * Counting
+ * --------
+ *
+ * A counting filter (cbloom_t) keeps a 4-bit counter in place of each bit,
+ * 128 of them to a block, so that keys can be removed as well as added. A
+ * counter that reaches CBLOOM_MAX stays there, since we no longer know how
+ * many keys are behind it. It costs four times the memory of the plain
+ * filter for the same n and p.
+ *
+ ******************************************************************************/
+
+#define BLOOM_WORDS  (BLOOM_BLOCK / sizeof(uint64_t)) // words per block
+#define BLOOM_BITS   (BLOOM_BLOCK * CHAR_BIT)         // bits per block
+#define CBLOOM_SLOTS (BLOOM_BLOCK * 2)                // counters per block
+#define ROUND(x, y)  (((x) + (y) - 1) / (y))
 
 
+/**
+ * bloom_hash
+ * ``````````
+ * Hash a key to 64 bits.
+ *
+ * @key  : the key
+ * @len  : length of the key in bytes
+ * Return: the hash.
+ *
+ * NOTES
+ * This is Austin Appleby's MurmurHash64A, which takes the key eight bytes
+ * at a time. It is not meant to resist anyone trying to make collisions.
+ */
+uint64_t bloom_hash(const void *key, size_t len)
+{
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        const unsigned char *p = key;
+        uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+        uint64_t w;
+
+        for (; len >= 8; p += 8, len -= 8) {
+                memcpy(&w, p, 8);
+
+                w *= m;
+                w ^= w >> r;
+                w *= m;
+
+                h ^= w;
+                h *= m;
+        }
+
+        if (len > 0) {
+                w = 0;
+                memcpy(&w, p, len);
+                h ^= w;
+                h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+
+        return h;
+}
+
+
+/**
+ * bloom_size
+ * ``````````
+ * Work out the number of bits and probes for a filter.
+ *
+ * @n    : number of keys the filter must hold
+ * @p    : false positive rate it should have with n keys
+ * @m    : destination of the number of bits (or counters)
+ * @k    : destination of the number of probes
+ * Return: false if p is not a probability, otherwise true.
+ */
+static bool bloom_size(size_t n, double p, double *m, size_t *k)
+{
+        double kk;
+
+        if (!(p > 0.0 && p < 1.0))
+                return false;
+
+        if (n == 0)
+                n = 1;
+
+        *m = -((n * log(p)) / (M_LN2 * M_LN2));
+        kk = (*m / n) * M_LN2;
+
+        *k = (kk < 1.0) ? 1 : (kk > BLOOM_KMAX) ? BLOOM_KMAX : (size_t)(kk + 0.5);
+
+        return true;
+}
+
+
+/**
+ * bloom_block
+ * ```````````
+ * Choose the block for a hash.
+ *
+ * @h      : the hash
+ * @nblocks: number of blocks in the filter
+ * Return  : index of the block.
+ *
+ * NOTE
+ * Multiplying the top 32 bits by the number of blocks maps them onto the
+ * blocks evenly, without a division, and without the number of blocks
+ * having to be a power of 2.
+ */
+static inline size_t bloom_block(uint64_t h, size_t nblocks)
+{
+        return (size_t)(((h >> 32) * (uint64_t)nblocks) >> 32);
+}
+
+
+/**
+ * bloom_probe
+ * ```````````
+ * Derive the start and stride of the probes within a block.
+ *
+ * @h    : the hash
+ * @x    : destination of the first probe
+ * @y    : destination of the stride (odd)
+ * Return: nothing.
+ */
+static inline void bloom_probe(uint64_t h, uint32_t *x, uint32_t *y)
+{
+        h *= 0x9e3779b97f4a7c15ULL; // remix, so the block bits are not reused
+
+        *x = (uint32_t)(h >> 32);
+        *y = (uint32_t)h | 1;
+}
+
+
+/**
+ * bloom_alloc
+ * ```````````
+ * Allocate zeroed blocks.
+ *
+ * @nblocks: number of blocks
+ * Return  : pointer to the blocks, or NULL.
+ */
+static void *bloom_alloc(size_t nblocks)
+{
+        void *a;
+
+        if (!(a = aligned_alloc(BLOOM_BLOCK, nblocks * BLOOM_BLOCK)))
+                return NULL;
+
+        return memset(a, 0, nblocks * BLOOM_BLOCK);
+}
+
+
+
+/******************************************************************************
+ * PLAIN 
+ ******************************************************************************/
+
 /**
  * bloom_new  Allocate and return a pointer to a new Bloom filter.
  * `````````
- * @size  : size of the bit array in the filter
- * @nfuncs: the number of hash functions 
- * Returns: An allocated bloom filter 
- *
- * USAGE
- * For best results, make 'size' a power of 2.
+ * @n     : number of keys the filter must hold
+ * @p     : false positive rate it should have with n keys, e.g. 0.01
+ * Returns: An allocated bloom filter, or NULL.
  */
-struct bloom_t *bloom_new(size_t size, size_t num_hashes, ...)
+struct bloom_t *bloom_new(size_t n, double p)
 {
         struct bloom_t *bloom;
-        va_list hashes;
-        int n;
+        double m;
+        size_t k;
+
+        if (!bloom_size(n, p, &m, &k))
+                return NULL;
 
         /* Allocate Bloom filter container */
         if (!(bloom = malloc(sizeof(struct bloom_t))))
                 return NULL;
 
-        /* Allocate Bloom array */
-        if (!(bloom->a = calloc(ROUND(size), sizeof(char)))) {
-                free(bloom);
-                return NULL;
-        }
+        bloom->nblocks = ROUND((size_t)m + 1, BLOOM_BITS);
+        bloom->m       = bloom->nblocks * BLOOM_BITS;
+        bloom->k       = k;
 
-        /* Allocate Bloom filter hash function pointers */
-        if (!(bloom->hash = (hashfp_t*)malloc(num_hashes*sizeof(hashfp_t)))) {
-                free(bloom->a);
+        /* Allocate Bloom array */
+        if (!(bloom->a = bloom_alloc(bloom->nblocks))) {
                 free(bloom);
                 return NULL;
         }
 
-        /* Assign hash functions to pointers in the Bloom filter */
-        va_start(hashes, num_hashes);
-
-                for (n=0; n<num_hashes; n++)
-                        bloom->hash[n] = va_arg(hashes, hashfp_t);
-
-        va_end(hashes);
-
-        /* 
-         * Record the number of hash functions (k) and the number of bytes
-         * in the Bloom array (m).
-         */
-        bloom->k = num_hashes;
-        bloom->m = size;
-
         return bloom;
 }
 
@@ -179,11 +356,59 @@ struct bloom_t *bloom_new(size_t size, size_t num_hashes, ...)
 void bloom_del(struct bloom_t *bloom)
 {
         free(bloom->a);
-        free(bloom->hash);
         free(bloom);
 }
 
 
+/**
+ * bloom_set
+ * `````````
+ * Set the bits of a hash.
+ *
+ * @bloom : Bloom filter
+ * @h     : hash of the key
+ * Returns: nothing.
+ */
+static inline void bloom_set(struct bloom_t *bloom, uint64_t h)
+{
+        uint64_t *b = bloom->a + bloom_block(h, bloom->nblocks) * BLOOM_WORDS;
+        uint32_t x;
+        uint32_t y;
+        size_t i;
+
+        bloom_probe(h, &x, &y);
+
+        for (i=0; i<bloom->k; i++, x+=y)
+                b[(x % BLOOM_BITS) / 64] |= 1ULL << (x % 64);
+}
+
+
+/**
+ * bloom_get
+ * `````````
+ * Test the bits of a hash.
+ *
+ * @bloom : Bloom filter
+ * @h     : hash of the key
+ * Returns: true if every bit is set.
+ */
+static inline bool bloom_get(const struct bloom_t *bloom, uint64_t h)
+{
+        const uint64_t *b = bloom->a + bloom_block(h, bloom->nblocks) * BLOOM_WORDS;
+        uint32_t x;
+        uint32_t y;
+        size_t i;
+
+        bloom_probe(h, &x, &y);
+
+        for (i=0; i<bloom->k; i++, x+=y) {
+                if (!(b[(x % BLOOM_BITS) / 64] & (1ULL << (x % 64))))
+                        return false;
+        }
+        return true;
+}
+
+
 /**
  * bloom_add  Add a string to a Bloom filter.
  * `````````
@@ -193,16 +418,11 @@ void bloom_del(struct bloom_t *bloom)
  *
  * CAVEAT 
  * Once a string has been added to the filter, it cannot be "removed"!
+ * (But see cbloom_remove.)
  */
 void bloom_add(struct bloom_t *bloom, const char *s)
 {
-        unsigned int hash;
-        int n;
-
-        for (n=0; n<bloom->k; n++) {
-                hash = (unsigned int)bloom->hash[n](s);
-                SETBIT(bloom->a, (hash % bloom->m));
-        }
+        bloom_set(bloom, bloom_hash(s, strlen(s)));
 }
 
 
@@ -218,10 +438,9 @@ void bloom_add(struct bloom_t *bloom, const char *s)
  * So this is the freakshow that bored programmers pay a nickel to get a
  * peek at, step right up. This is the way the membership test works.
  *
- * The string 's' is hashed once for each of the 'k' hash functions, as 
- * though we were planning to add it to the filter. Instead of adding it
- * however, we examine the bit that we *would* have set, and consider its
- * value.
+ * The string 's' is hashed as though we were planning to add it to the
+ * filter. Instead of adding it however, we examine each of the k bits
+ * that we *would* have set, and consider its value.
  *
  * If the bit is 1 (set), the string we are hashing may be in the filter,
  * since it would have set this bit when it was originally hashed. However,
@@ -230,7 +449,7 @@ void bloom_add(struct bloom_t *bloom, const char *s)
  * we have k > 1, so we can minimize the likelihood of false positives 
  * occuring.
  *
- * If every bit corresponding to every one of the k hashes of our query 
+ * If every bit corresponding to every one of the k probes of our query 
  * string is set, we can say with some probability of being correct that 
  * the string we are holding is indeed "in" the filter. However, we can 
  * never be sure. 
@@ -246,14 +465,232 @@ void bloom_add(struct bloom_t *bloom, const char *s)
  */
 bool bloom_check(struct bloom_t *bloom, const char *s)
 {
-        unsigned int hash;
-        int n;
+        return bloom_get(bloom, bloom_hash(s, strlen(s))); /* ? */
+}
+
+
+/**
+ * bloom_check_many  Determine which of several strings are in the filter.
+ * ````````````````
+ * @bloom : Bloom filter
+ * @s     : strings to check
+ * @n     : number of strings
+ * @hit   : destination of the result for each string (n of them)
+ * Returns: number of strings that may be in the filter.
+ *
+ * NOTES
+ * A single lookup spends most of its time waiting for its block to come
+ * in from memory. Here each string is hashed BLOOM_PREFETCH strings ahead
+ * of its probe, and its block prefetched, so that the misses of several
+ * lookups are waited for at once.
+ */
+size_t bloom_check_many(struct bloom_t *bloom, const char **s, size_t n, bool *hit)
+{
+        uint64_t h[BLOOM_PREFETCH];
+        size_t count = 0;
+        size_t i;
+        size_t j;
+
+        for (i=0; i<n && i<BLOOM_PREFETCH; i++) {
+                h[i] = bloom_hash(s[i], strlen(s[i]));
+                __builtin_prefetch(bloom->a + bloom_block(h[i], bloom->nblocks) * BLOOM_WORDS);
+        }
+
+        for (i=0; i<n; i++) {
+                j = i % BLOOM_PREFETCH;
+
+                if ((hit[i] = bloom_get(bloom, h[j])))
+                        count++;
+
+                /* Reuse the slot for the string BLOOM_PREFETCH ahead */
+                if (i + BLOOM_PREFETCH < n) {
+                        h[j] = bloom_hash(s[i + BLOOM_PREFETCH], strlen(s[i + BLOOM_PREFETCH]));
+                        __builtin_prefetch(bloom->a + bloom_block(h[j], bloom->nblocks) * BLOOM_WORDS);
+                }
+        }
+
+        return count;
+}
+
+
+/**
+ * bloom_union  Merge one Bloom filter into another.
+ * ```````````
+ * @dst   : Bloom filter, which becomes the filter of the union
+ * @src   : Bloom filter of the same shape
+ * Returns: false if the filters are not the same shape, otherwise true.
+ */
+bool bloom_union(struct bloom_t *dst, const struct bloom_t *src)
+{
+        size_t i;
+
+        if (dst->m != src->m || dst->k != src->k)
+                return false;
+
+        for (i=0; i<dst->nblocks * BLOOM_WORDS; i++)
+                dst->a[i] |= src->a[i];
+
+        return true;
+}
+
+
+/**
+ * bloom_intersect  Intersect one Bloom filter with another.
+ * ```````````````
+ * @dst   : Bloom filter, which becomes the filter of the intersection
+ * @src   : Bloom filter of the same shape
+ * Returns: false if the filters are not the same shape, otherwise true.
+ */
+bool bloom_intersect(struct bloom_t *dst, const struct bloom_t *src)
+{
+        size_t i;
+
+        if (dst->m != src->m || dst->k != src->k)
+                return false;
+
+        for (i=0; i<dst->nblocks * BLOOM_WORDS; i++)
+                dst->a[i] &= src->a[i];
+
+        return true;
+}
+
+
+
+/******************************************************************************
+ * COUNTING 
+ ******************************************************************************/
+
+#define CGET(b, x)    (((b)[(x) / 2] >> (((x) % 2) * 4)) & 0x0f)
+#define CINC(b, x)    ((b)[(x) / 2] += 1 << (((x) % 2) * 4))
+#define CDEC(b, x)    ((b)[(x) / 2] -= 1 << (((x) % 2) * 4))
+
+
+/**
+ * cbloom_new  Allocate and return a pointer to a new counting Bloom filter.
+ * ``````````
+ * @n     : number of keys the filter must hold
+ * @p     : false positive rate it should have with n keys, e.g. 0.01
+ * Returns: An allocated counting Bloom filter, or NULL.
+ */
+struct cbloom_t *cbloom_new(size_t n, double p)
+{
+        struct cbloom_t *cb;
+        double m;
+        size_t k;
+
+        if (!bloom_size(n, p, &m, &k))
+                return NULL;
+
+        if (!(cb = malloc(sizeof(struct cbloom_t))))
+                return NULL;
+
+        cb->nblocks = ROUND((size_t)m + 1, CBLOOM_SLOTS);
+        cb->m       = cb->nblocks * CBLOOM_SLOTS;
+        cb->k       = k;
+
+        if (!(cb->c = bloom_alloc(cb->nblocks))) {
+                free(cb);
+                return NULL;
+        }
+
+        return cb;
+}
+
+
+/**
+ * cbloom_del  Delete a counting Bloom filter.
+ * ``````````
+ * @cb    : The condemned. 
+ * Returns: nothing. 
+ */
+void cbloom_del(struct cbloom_t *cb)
+{
+        free(cb->c);
+        free(cb);
+}
+
+
+/**
+ * cbloom_add  Add a string to a counting Bloom filter.
+ * ``````````
+ * @cb    : counting Bloom filter
+ * @s     : string to add
+ * Returns: nothing. 
+ */
+void cbloom_add(struct cbloom_t *cb, const char *s)
+{
+        uint64_t h = bloom_hash(s, strlen(s));
+        uint8_t *b = cb->c + bloom_block(h, cb->nblocks) * BLOOM_BLOCK;
+        uint32_t x;
+        uint32_t y;
+        size_t i;
+
+        bloom_probe(h, &x, &y);
+
+        for (i=0; i<cb->k; i++, x+=y) {
+                if (CGET(b, x % CBLOOM_SLOTS) < CBLOOM_MAX)
+                        CINC(b, x % CBLOOM_SLOTS);
+        }
+}
+
+
+/**
+ * cbloom_check  Determine if a string is in a counting Bloom filter.
+ * ````````````
+ * @cb    : counting Bloom filter
+ * @s     : string to check
+ * Returns: false if string does not exist in the filter, otherwise true. 
+ */
+bool cbloom_check(struct cbloom_t *cb, const char *s)
+{
+        uint64_t h = bloom_hash(s, strlen(s));
+        uint8_t *b = cb->c + bloom_block(h, cb->nblocks) * BLOOM_BLOCK;
+        uint32_t x;
+        uint32_t y;
+        size_t i;
+
+        bloom_probe(h, &x, &y);
 
-        for (n=0; n<bloom->k; n++) {
-                hash = (unsigned int)bloom->hash[n](s);
-                if (!(GETBIT(bloom->a, (hash % bloom->m))))
+        for (i=0; i<cb->k; i++, x+=y) {
+                if (CGET(b, x % CBLOOM_SLOTS) == 0)
                         return false;
         }
-        return true; /* ? */
+        return true;
 }
 
+
+/**
+ * cbloom_remove  Remove a string from a counting Bloom filter.
+ * `````````````
+ * @cb    : counting Bloom filter
+ * @s     : string to remove
+ * Returns: false if the string was not in the filter, otherwise true.
+ *
+ * CAVEAT
+ * Only remove strings that were added. Removing a false positive takes
+ * away counts that belong to other strings, and they may then be found
+ * missing, which a Bloom filter is otherwise never wrong about.
+ */
+bool cbloom_remove(struct cbloom_t *cb, const char *s)
+{
+        uint64_t h = bloom_hash(s, strlen(s));
+        uint8_t *b = cb->c + bloom_block(h, cb->nblocks) * BLOOM_BLOCK;
+        uint32_t x0;
+        uint32_t x;
+        uint32_t y;
+        size_t i;
+
+        bloom_probe(h, &x0, &y);
+
+        /* Don't touch anything unless it's all there */
+        for (i=0, x=x0; i<cb->k; i++, x+=y) {
+                if (CGET(b, x % CBLOOM_SLOTS) == 0)
+                        return false;
+        }
+
+        for (i=0, x=x0; i<cb->k; i++, x+=y) {
+                if (CGET(b, x % CBLOOM_SLOTS) < CBLOOM_MAX)
+                        CDEC(b, x % CBLOOM_SLOTS);
+        }
+        return true;
+}
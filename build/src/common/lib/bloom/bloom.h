@@ -4,20 +4,53 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include "hashes.h"
 
-typedef unsigned int (*hashfp_t)(const char *);
 
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define BLOOM_BLOCK    (64) // bytes per block, i.e. one cache line
+#define BLOOM_KMAX     (16) // most probes per key
+#define BLOOM_PREFETCH (8)  // keys hashed ahead of the probe in check_many
+
+
+/* Bloom filter
+``````````````````````````````````````````````````````````````````````````````*/
 struct bloom_t {
-        size_t m;
-        size_t k;
-        unsigned char *a;
-        hashfp_t *hash;
+        size_t m;          // number of bits
+        size_t k;          // number of probes per key
+        size_t nblocks;    // number of blocks of BLOOM_BLOCK bytes
+        uint64_t *a;       // the bits (aligned to BLOOM_BLOCK)
 };
 
-struct bloom_t *bloom_new(size_t size, size_t num_hashes, ...);
-void bloom_del  (struct bloom_t *bloom);
-void bloom_add  (struct bloom_t *bloom, const char *s);
-bool bloom_check(struct bloom_t *bloom, const char *s);
+uint64_t bloom_hash(const void *key, size_t len);
+
+struct bloom_t *bloom_new  (size_t n, double p);
+void            bloom_del  (struct bloom_t *bloom);
+void            bloom_add  (struct bloom_t *bloom, const char *s);
+bool            bloom_check(struct bloom_t *bloom, const char *s);
+
+size_t bloom_check_many(struct bloom_t *bloom, const char **s, size_t n, bool *hit);
+
+bool bloom_union    (struct bloom_t *dst, const struct bloom_t *src);
+bool bloom_intersect(struct bloom_t *dst, const struct bloom_t *src);
+
+
+/* Counting Bloom filter
+``````````````````````````````````````````````````````````````````````````````*/
+#define CBLOOM_MAX (15) // a 4-bit counter sticks here, and is never decremented
+
+struct cbloom_t {
+        size_t m;          // number of counters
+        size_t k;          // number of probes per key
+        size_t nblocks;    // number of blocks of BLOOM_BLOCK bytes
+        uint8_t *c;        // the counters, two to a byte (aligned to BLOOM_BLOCK)
+};
+
+struct cbloom_t *cbloom_new   (size_t n, double p);
+void             cbloom_del   (struct cbloom_t *cb);
+void             cbloom_add   (struct cbloom_t *cb, const char *s);
+bool             cbloom_remove(struct cbloom_t *cb, const char *s);
+bool             cbloom_check (struct cbloom_t *cb, const char *s);
+
 
 #endif
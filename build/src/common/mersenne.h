@@ -47,8 +47,8 @@
 #define MAGIC(s)        (((s)&1)*MATRIX_A)
 
 
-unsigned long mt[MT_LEN]; /* stores the state of the generator */
-int mt_index;   
+static unsigned long mt[MT_LEN]; /* stores the state of the generator */
+static int mt_index;
 
 
 /**
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "stats.h"
+
+
+/******************************************************************************
+ * STATISTICS
+ *
+ * The counters and histograms here are bumped in the hot loops of the
+ * pump daemon, so they are plain integers, and a histogram is an array
+ * of log-linear buckets: each power of two is cut into HIST_SUB equal
+ * parts (see hist_bucket()), so adding a value costs a count-leading-zeros
+ * and a few increments. A quantile is given as the top of the bucket it
+ * falls in, which is an upper bound, and over by at most 1/HIST_SUB.
+ *
+ * Stat files
+ * ----------
+ *
+ * Every so often, each process that keeps a stats_t writes it out, one
+ * "key value" pair per line, which is easy to read with awk, and easy to
+ * diff. A histogram comes out as a few lines of summary, and a line with
+ * the buckets themselves:
+ *
+ *      lag_us.count 2000
+ *      lag_us.sum 1813309
+ *      lag_us.mean 906
+ *      lag_us.p50 895
+ *      lag_us.p99 2559
+ *      lag_us.max 3120
+ *      lag_us.hist 0 0 0 0 0 0 0 0 0 0 0 0 ... 12 388 601 452 300 ...
+ *
+ * The .p50 and .p99 lines are the upper bounds from hist_quantile(); the
+ * true figures are somewhere in the bucket below them.
+ *
+ * Only the counters and the buckets are read back in by stats_read(); the
+ * rest is worked out from them. That way the files of several processes
+ * (e.g. one per pump, in fork mode) can be added up with stats_merge(),
+ * and the quantiles of the whole taken afterwards.
+ *
+ ******************************************************************************/
+
+static const struct { const char *key; size_t off; } COUNTERS[] = {
+        { "pumps",        offsetof(struct stats_t, pumps)     },
+        { "clients",      offsetof(struct stats_t, clients)   },
+        { "scanned",      offsetof(struct stats_t, scanned)   },
+        { "seen_hits",    offsetof(struct stats_t, seen_hits) },
+        { "sent",         offsetof(struct stats_t, sent)      },
+        { "acked",        offsetof(struct stats_t, acked)     },
+        { "wakeups",      offsetof(struct stats_t, wakeups)   },
+        { "idle_wakeups", offsetof(struct stats_t, idle)      },
+};
+
+static const struct { const char *key; size_t off; } HISTS[] = {
+        { "scan_us", offsetof(struct stats_t, scan_us) },
+        { "lag_us",  offsetof(struct stats_t, lag_us)  },
+};
+
+#define NCOUNTERS (sizeof(COUNTERS) / sizeof(COUNTERS[0]))
+#define NHISTS    (sizeof(HISTS) / sizeof(HISTS[0]))
+
+#define STREQ(a, b)   (strcmp((a), (b)) == 0)
+#define COUNTER(s, i) ((uint64_t *)((char *)(s) + COUNTERS[i].off))
+#define HIST(s, i)    ((struct hist_t *)((char *)(s) + HISTS[i].off))
+
+
+
+/******************************************************************************
+ * HISTOGRAMS
+ ******************************************************************************/
+
+/**
+ * hist_top
+ * ````````
+ * Get the largest value a bucket holds (see hist_bucket()).
+ *
+ * @i    : the bucket
+ * Return: the value.
+ */
+static uint64_t hist_top(int i)
+{
+        int e;
+
+        if (i < HIST_SUB)
+                return (uint64_t)i;
+
+        e = i / HIST_SUB + HIST_SUBBITS - 1;
+
+        return ((uint64_t)(HIST_SUB + i % HIST_SUB) << (e - HIST_SUBBITS))
+             + (1ULL << (e - HIST_SUBBITS)) - 1;
+}
+
+
+/**
+ * hist_quantile
+ * `````````````
+ * Estimate a quantile of the values in a histogram.
+ *
+ * @h    : pointer to a histogram
+ * @q    : the quantile, e.g. 0.5 for the median, 0.99 for p99
+ * Return: the upper bound of the bucket the quantile falls in (and no
+ *         more than the largest value), or 0 if the histogram is empty.
+ */
+uint64_t hist_quantile(const struct hist_t *h, double q)
+{
+        uint64_t rank;
+        uint64_t seen = 0;
+        uint64_t top;
+        int i;
+
+        if (h->count == 0)
+                return 0;
+
+        rank = (uint64_t)(q * h->count);
+
+        if (rank >= h->count)
+                rank = h->count - 1;
+
+        for (i=0; i<HIST_BUCKETS; i++) {
+                seen += h->bucket[i];
+                if (seen > rank)
+                        break;
+        }
+
+        top = (i < HIST_BUCKETS - 1) ? hist_top(i) : UINT64_MAX;
+
+        return (top < h->max) ? top : h->max;
+}
+
+
+/**
+ * hist_merge
+ * ``````````
+ * Add the values of one histogram into another.
+ *
+ * @dst  : pointer to a histogram
+ * @src  : pointer to another
+ * Return: nothing.
+ */
+void hist_merge(struct hist_t *dst, const struct hist_t *src)
+{
+        int i;
+
+        for (i=0; i<HIST_BUCKETS; i++)
+                dst->bucket[i] += src->bucket[i];
+
+        dst->count += src->count;
+        dst->sum   += src->sum;
+
+        if (src->max > dst->max)
+                dst->max = src->max;
+}
+
+
+
+/******************************************************************************
+ * STAT FILES
+ ******************************************************************************/
+
+/**
+ * stats_write
+ * ```````````
+ * Write a set of counters, one "key value" pair per line.
+ *
+ * @f    : the stream to write to
+ * @s    : pointer to the counters
+ * Return: nothing.
+ */
+void stats_write(FILE *f, const struct stats_t *s)
+{
+        const struct hist_t *h;
+        size_t i;
+        int b;
+
+        for (i=0; i<NCOUNTERS; i++)
+                fprintf(f, "%s %llu\n", COUNTERS[i].key,
+                        (unsigned long long)*COUNTER(s, i));
+
+        for (i=0; i<NHISTS; i++) {
+                h = HIST(s, i);
+
+                fprintf(f, "%s.count %llu\n", HISTS[i].key, (unsigned long long)h->count);
+                fprintf(f, "%s.sum %llu\n",   HISTS[i].key, (unsigned long long)h->sum);
+                fprintf(f, "%s.mean %llu\n",  HISTS[i].key,
+                        (unsigned long long)(h->count ? h->sum / h->count : 0));
+                fprintf(f, "%s.p50 %llu\n",   HISTS[i].key,
+                        (unsigned long long)hist_quantile(h, 0.50));
+                fprintf(f, "%s.p99 %llu\n",   HISTS[i].key,
+                        (unsigned long long)hist_quantile(h, 0.99));
+                fprintf(f, "%s.max %llu\n",   HISTS[i].key, (unsigned long long)h->max);
+
+                fprintf(f, "%s.hist", HISTS[i].key);
+                for (b=0; b<HIST_BUCKETS; b++)
+                        fprintf(f, " %llu", (unsigned long long)h->bucket[b]);
+                fprintf(f, "\n");
+        }
+}
+
+
+/**
+ * stats_read
+ * ``````````
+ * Read a set of counters back in from a stat file.
+ *
+ * @path : path of the stat file
+ * @s    : pointer to the counters (zeroed here)
+ * Return: false if the file could not be opened, otherwise true.
+ *
+ * NOTE
+ * Lines with keys that are not counters or histograms are skipped, so the
+ * writer is free to put other things in the file.
+ */
+bool stats_read(const char *path, struct stats_t *s)
+{
+        char line[HIST_BUCKETS * 21 + 64]; // the .hist line, at its longest
+        char key[64];
+        unsigned long long v;
+        struct hist_t *h;
+        const char *sfx;
+        char *p;
+        size_t i;
+        int b;
+        int n;
+        FILE *f;
+
+        memset(s, 0, sizeof(struct stats_t));
+
+        if (!(f = fopen(path, "r")))
+                return false;
+
+        while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "%63s %n", key, &n) != 1)
+                        continue;
+
+                p = line + n;
+
+                for (i=0; i<NCOUNTERS; i++) {
+                        if (STREQ(key, COUNTERS[i].key) && sscanf(p, "%llu", &v) == 1)
+                                *COUNTER(s, i) = v;
+                }
+
+                for (i=0; i<NHISTS; i++) {
+                        if (strncmp(key, HISTS[i].key, strlen(HISTS[i].key)) != 0)
+                                continue;
+
+                        h   = HIST(s, i);
+                        sfx = key + strlen(HISTS[i].key);
+
+                        if (STREQ(sfx, ".count") && sscanf(p, "%llu", &v) == 1)
+                                h->count = v;
+                        else if (STREQ(sfx, ".sum") && sscanf(p, "%llu", &v) == 1)
+                                h->sum = v;
+                        else if (STREQ(sfx, ".max") && sscanf(p, "%llu", &v) == 1)
+                                h->max = v;
+                        else if (STREQ(sfx, ".hist")) {
+                                for (b=0; b<HIST_BUCKETS && sscanf(p, "%llu%n", &v, &n) == 1; b++) {
+                                        h->bucket[b] = v;
+                                        p += n;
+                                }
+                        }
+                }
+        }
+
+        fclose(f);
+
+        return true;
+}
+
+
+/**
+ * stats_merge
+ * ```````````
+ * Add one set of counters into another.
+ *
+ * @dst  : pointer to the counters
+ * @src  : pointer to the counters to add
+ * Return: nothing.
+ */
+void stats_merge(struct stats_t *dst, const struct stats_t *src)
+{
+        size_t i;
+
+        for (i=0; i<NCOUNTERS; i++)
+                *COUNTER(dst, i) += *COUNTER(src, i);
+
+        for (i=0; i<NHISTS; i++)
+                hist_merge(HIST(dst, i), HIST(src, i));
+}
@@ -0,0 +1,100 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define HIST_SUBBITS  (2)    // a power of two is cut into 2^HIST_SUBBITS...
+#define HIST_SUB      (1 << HIST_SUBBITS)              // ...equal buckets
+#define HIST_BUCKETS  ((40 - HIST_SUBBITS) * HIST_SUB) // up to 2^39 (us is days)
+#define STAT_INTERVAL (1000) // least milliseconds between writes of a stat file
+
+
+/* Histograms
+``````````````````````````````````````````````````````````````````````````````*/
+struct hist_t {
+        uint64_t count;                // values added
+        uint64_t sum;                  // ...their total
+        uint64_t max;                  // ...and the largest
+        uint64_t bucket[HIST_BUCKETS]; // see hist_bucket()
+};
+
+uint64_t hist_quantile(const struct hist_t *h, double q);
+void     hist_merge   (struct hist_t *dst, const struct hist_t *src);
+
+/*
+ * Values under HIST_SUB have a bucket each. Above that, the values from
+ * 2^e up to 2^(e+1) share HIST_SUB buckets, picked by the HIST_SUBBITS
+ * bits under the leading one.
+ */
+static inline int hist_bucket(uint64_t v)
+{
+        int e;
+
+        if (v < HIST_SUB)
+                return (int)v;
+
+        e = 63 - __builtin_clzll(v);
+
+        return (e - HIST_SUBBITS + 1) * HIST_SUB
+             + (int)((v >> (e - HIST_SUBBITS)) & (HIST_SUB - 1));
+}
+
+/* An add is a count-leading-zeros, a shift, and three increments */
+static inline void hist_add(struct hist_t *h, uint64_t v)
+{
+        int i = hist_bucket(v);
+
+        if (i >= HIST_BUCKETS)
+                i = HIST_BUCKETS - 1;
+
+        h->bucket[i]++;
+        h->count++;
+        h->sum += v;
+
+        if (v > h->max)
+                h->max = v;
+}
+
+
+/* Counters of the pump daemon (see pumps.c)
+``````````````````````````````````````````````````````````````````````````````*/
+struct stats_t {
+        uint64_t pumps;        // pumps open
+        uint64_t clients;      // subscribers connected
+        uint64_t scanned;      // files checked against the seen-set
+        uint64_t seen_hits;    // ...and found there already
+        uint64_t sent;         // names put on channels
+        uint64_t acked;        // ...and credited back by subscribers
+        uint64_t wakeups;      // times the pump woke up
+        uint64_t idle;         // ...and had nothing to send
+        struct hist_t scan_us; // time taken by each scan or batch of events
+        struct hist_t lag_us;  // time from a file's mtime to its name being sent
+};
+
+void stats_write(FILE *f, const struct stats_t *s);
+bool stats_read (const char *path, struct stats_t *s);
+void stats_merge(struct stats_t *dst, const struct stats_t *src);
+
+
+/* Clocks
+``````````````````````````````````````````````````````````````````````````````*/
+static inline uint64_t usec_of(const struct timespec *ts)
+{
+        return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static inline uint64_t usec_now(clockid_t clock)
+{
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return usec_of(&ts);
+}
+
+
+#endif
@@ -294,11 +294,15 @@ void pumpf(char **strp, const char *fmt, ...)
  * Search memory starting at src for character 'c'
  * If 'c' is found within 'len' characters of 'src', a pointer
  * to the character is returned. Otherwise, NULL is returned.
+ *
+ * NOTE
+ * Once aligned, this reads a word at a time and only looks at the
+ * bytes of a word that contains 'c'.
  */
 void *textutils_memchr(const void *src_void, int c, size_t len)
 {
-        const int *src = (const int *)src_void;
-        int d = c;
+        const unsigned char *src = (const unsigned char *)src_void;
+        unsigned char d = (unsigned char)c;
 
         #if !defined(PREFER_SIZE_OVER_SPEED) && !defined(__OPTIMIZE_SIZE__)
         unsigned long *asrc;
@@ -326,7 +330,8 @@ void *textutils_memchr(const void *src_void, int c, size_t len)
                  * detecting for the presence of NUL in the result.  
                  */
                 asrc = (unsigned long *)src;
-                mask = ((d << 8) | d);
+                mask = d;
+                mask = ((mask << 8) | mask);
                 mask = ((mask << 16) | mask);
 
                 for (i=32; i<8*LONGBYTES; i<<=1) {
@@ -343,7 +348,7 @@ void *textutils_memchr(const void *src_void, int c, size_t len)
                  * If there are fewer than LONGBYTES characters left,
                  * we decay to the bytewise loop.
                  */
-                src = (int *)asrc;
+                src = (const unsigned char *)asrc;
         }
         #endif /* !PREFER_SIZE_OVER_SPEED */
 
@@ -441,9 +446,14 @@ void *textutils_memmem(const void *haystack, const void *needle)
         if (__builtin_expect (len_haystack < len_needle, 0))
                 return NULL;
 
+        /* Skip straight to each occurrence of the first character */
         for (begin = (const char *)haystack; begin <= final; ++begin) {
-                if (begin[0] == ((const char *) needle)[0]
-                && !memcmp((const void *)&begin[1], (const void *)((const char *)needle+1), len_needle-1))
+                begin = textutils_memchr(begin, ((const char *)needle)[0], final - begin + 1);
+
+                if (begin == NULL)
+                        break;
+
+                if (!memcmp((const void *)&begin[1], (const void *)((const char *)needle+1), len_needle-1))
                         return (void *)begin;
         }
 
@@ -4,12 +4,15 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <string.h>
 
 #include "eo.h"
 #include "lex.h"
 #include "meta.h"
 #include "parse.h"
 #include "regex.h"
+#include "pool.h"
+#include "pumps.h"
 #include "common/io/file.h"
 #include "common/io/dir.h"
 #include "common/ipc/daemon.h"
@@ -44,6 +47,19 @@ void catchsig(int signo)
 }
 
 
+/******************************************************************************
+ * OPTIONS
+ *
+ * -j N   run the routine on N files at once (see pool.c)
+ * -u     with -j, print output as it is finished, not in file order
+ * -x     run commands that end in {} once for many files, like xargs
+ *
+ ******************************************************************************/
+int JOBS  = 1;
+int ORDER = POOL_ORDERED;
+int XARGS = 0;
+
+
 /******************************************************************************
  * EO 
  * 
@@ -108,6 +124,34 @@ void eo_init(void)
 }
 
 
+/**
+ * eo_key
+ * ``````
+ * Make up the key that names our checkpoint with the pump daemon.
+ *
+ * @r    : the routine
+ * @key  : destination of the key (at least 17 bytes)
+ * Return: nothing.
+ *
+ * NOTE
+ * The key is a hash of the operations after the pump, so that the same
+ * routine picks up where it left off, and a different routine on the
+ * same directory gets every file over again (see seen.c).
+ */
+void eo_key(struct routine_t *r, char *key)
+{
+        uint64_t h = 0;
+        int i;
+
+        for (i=1; i<r->n; i++) {
+                h ^= bloom_hash(r->op[i]->operand, strlen(r->op[i]->operand));
+                h  = bloom_hash(&h, sizeof(h)) + r->op[i]->tag;
+        }
+
+        sprintf(key, "%016llx", (unsigned long long)h);
+}
+
+
 /**
  * eo_pump
  * ```````
@@ -120,34 +164,56 @@ void eo_init(void)
 void eo_pump(struct routine_t *r)
 {
         struct dpx_t dpx = {};
+        char key[32];
 
         sigreg(catchsig);
 
         /* Subscribe to the pump daemon's control channel */
         dpx_open(&dpx, CH("control"), CH_SUB);
 
-        /* Send the directory we want sucked. */
-        dpx_ping(&dpx, r->op[0]->operand); 
+        /* Send the directory we want sucked, and who is asking. */
+        eo_key(r, key);
+        dpx_pingf(&dpx, "%s\n%s", r->op[0]->operand, key); 
 
         /* Close control; open the channel control sent us. */ 
         dpx_close(&dpx);
+
+        if (dpx.buf[0] == PUMP_REFUSED)
+                bye("eo: pumpd refused %s", dpx.buf + 1);
+
         dpx_olink(&dpx, CH(dpx.buf), CH_SUB);
 
         EOPID = dpx.remote_pid; // See "Signal Handling", above.
 
         /* 
-         * Receive filenames until a "DONE" message 
-         * is received from the pump 
+         * Receive filenames until the pump hangs up. 
          */
-        for (;;) {
-                dpx_read(&dpx);
-                if (STRCMP(dpx.buf, "DONE")) {
-                        dpx_send(&dpx, "ack"); // Tell pump we received "done"
-                        continue;
+        if (JOBS > 1) {
+                struct pool_t *pool = pool_new(r, 1, JOBS, ORDER | XARGS);
+
+                /* Workers flush their batches when the queue runs dry. */
+                while (dpx_next(&dpx) == FR_DATA)
+                        pool_put(pool, dpx.buf);
+
+                pool_del(pool);
+        } else {
+                struct opctx_t ctx = { .out = stdout, .xargs = XARGS };
+                char *file;
+                int i;
+
+                while (dpx_next(&dpx) == FR_DATA) {
+                        slcpy(ctx.file, dpx.buf, PATHSIZE);
+                        file = ctx.file;
+
+                        /* The pump is op[0]; run the rest of the routine. */
+                        for (i=1; i<r->n; i++)
+                                r->op[i]->op(r->op[i], &ctx, &file);
+
+                        /* Caught up with the pump; don't sit on a batch. */
+                        if (!dpx_ready(&dpx))
+                                op_flush(&ctx);
                 }
-                char *file = sldup(dpx.buf, PATHSIZE);
-                r->op[1]->op(r->op[1]->operand, &file);
-                free(file);
+                op_flush(&ctx);
         }
         dpx_close(&dpx);
 }
@@ -164,17 +230,74 @@ void eo_pump(struct routine_t *r)
  */
 void eo_process(struct routine_t *r)
 {
+        struct opctx_t ctx = { .out = stdout, .xargs = XARGS };
+        struct pool_t *pool;
         char *filename;
         int i;
-        int j=0;
 
         printf("path: %s\n", r->path);
 
-        while (eo_nextfile(r->path, &filename), filename) {
+        if (JOBS > 1) {
+                pool = pool_new(r, 0, JOBS, ORDER | XARGS);
+
+                while (eo_nextfile(r, &filename) > 0)
+                        pool_put(pool, filename);
+
+                pool_del(pool);
+                return;
+        }
+
+        while (eo_nextfile(r, &filename) > 0) {
+                slcpy(ctx.file, filename, PATHSIZE);
+                filename = ctx.file;
+
                 for (i=0; i<r->n; i++) {
-                        r->op[i]->op(r->op[i]->operand, &filename);
+                        r->op[i]->op(r->op[i], &ctx, &filename);
                 }
         } 
+        op_flush(&ctx);
+}
+
+
+/**
+ * eo_opts
+ * ```````
+ * Take the options off the front of the command line.
+ *
+ * @argc : number of arguments (altered)
+ * @argv : vector of arguments (altered)
+ * Return: nothing.
+ */
+void eo_opts(int *argc, char ***argv)
+{
+        char **v = *argv;
+        int i = 1;
+
+        while (i < *argc && v[i][0] == '-') {
+                if ((STRCMP(v[i], "-j")) && i+1 < *argc) {
+                        JOBS = atoi(v[i+1]);
+                        i += 2;
+                } else if (!strncmp(v[i], "-j", 2) && v[i][2] != '\0') {
+                        JOBS = atoi(v[i]+2);
+                        i += 1;
+                } else if (STRCMP(v[i], "-u")) {
+                        ORDER = POOL_UNORDERED;
+                        i += 1;
+                } else if (STRCMP(v[i], "-x")) {
+                        XARGS = POOL_XARGS;
+                        i += 1;
+                } else {
+                        break;
+                }
+        }
+
+        if (JOBS < 1 || JOBS > POOL_MAX)
+                bye("-j must be between 1 and %d", POOL_MAX);
+
+        /* Shift the options out, keeping argv[0] */
+        v[i-1]  = v[0];
+        *argv  += i-1;
+        *argc  -= i-1;
 }
 
 
@@ -232,6 +355,8 @@ int main(int argc, char *argv[])
 {
         load_env(&ENV);
 
+        eo_opts(&argc, &argv);
+
         if (!ARG(1))
                 usage();
 
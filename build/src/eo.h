@@ -22,7 +22,11 @@
 "         config       open the config file for editing in a text editor\n"\
 "                                                                       \n"\
 "  OPTIONS                                                              \n"\
-"         Options aren't supported yet                                  \n"\
+"         -j N         run the routine on N files at once               \n"\
+"         -u           with -j, print output as each file finishes,     \n"\
+"                      rather than in the order of the files            \n"\
+"         -x           run a command that ends in {} once for many      \n"\
+"                      files at a time, as xargs does                   \n"\
 "                                                                       \n"\
 "  OPERANDS                                                             \n"\
 "         Tired of writing this now                                     \n"
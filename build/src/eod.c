@@ -17,6 +17,7 @@
 #include "common/configfiles.h"
 #include "common/textutils.h"
 #include "common/error.h"
+#include "common/stats.h"
 
 
 
@@ -71,7 +72,7 @@ void pumpd_init(void)
 /**
  * pumpd
  * `````
- * The loop driver executed by the running daemon
+ * The loop driver executed by the running daemon (P_FORK)
  * 
  * @dpx  : pointer to an open duplex stream in PUBLISH mode
  * Return: does not return.
@@ -82,28 +83,36 @@ void pumpd_init(void)
  * for a client to provide it with a path, then it creates a pump to
  * handle that path and tells the client and pump what channel to meet
  * up on. 
+ *
+ * The channel is created here, before the pump is forked, so that it
+ * is there to be opened as soon as the client is told its name.
  */
 void pumpd(struct dpx_t *dpx)
 {
+        char target[PATHSIZE];
+        char key[SEEN_KEY+1];
         char id[PATHSIZE];
+        long forked = 0;
 
-        for (;;) {
-                /* Load the tempfile template */
-                slcpy(id, "XXXXXX", PATHSIZE);
+        pumps_stat(P_FORK, forked);
 
+        for (;;) {
                 /* Wait for a pump request */
                 dpx_read(dpx);
 
                 if (dpx->buf[0] != '\0') {
-                        /* Turn the template into a tempname */
-                        tempname(id);
+                        /* Make up a name for the pump's channel */
+                        pumps_name(id, forked + 1);
+
+                        /* Create the channel for the pump handler */
+                        dpx_creat(CHANNEL(id));
 
                         /* Spawn a pump handler with that name */
-                        open_pump(new_pump(dpx->buf, id, P_FORK));
+                        pump_parse(dpx->buf, target, key);
+                        open_pump(new_pump(target, key, id, P_FORK));
+
+                        pumps_stat(P_FORK, ++forked);
 
-                        /* Wait for pump handler to create files */
-                        while (!exists(CHANNEL(id)))
-                                ;
                         /* Tell client where to connect */
                         dpx_send(dpx, id);
                 }
@@ -117,12 +126,11 @@ void pumpd(struct dpx_t *dpx)
  * ```````````
  * Spawn a daemon, acquire a duplex channel, and listen
  *
+ * @mode : P_KEEP to serve every pump from the daemon process, or P_FORK
+ *         to fork a process for each one
  * Return: does not return.
- *
- * FIXME
- * This needs to be factored with pump_open() in pumps.c 
  */
-void pumpd_start(void)
+void pumpd_start(int mode)
 {
         struct dpx_t dpx;
 
@@ -136,11 +144,19 @@ void pumpd_start(void)
         /* Create a new pidfile */
         pidfile(PID_PATH, "w+");
 
-        /* Open the control channel as publisher */
-        dpx_open(&dpx, CHANNEL("control"), CH_NEW | CH_PUB);
+        if (mode == P_KEEP) {
+                /* Open the control channel as a non-blocking publisher */
+                dpx_open(&dpx, CHANNEL("control"), CH_NEW | CH_PUB | CH_NIO);
+
+                /* Enter the event loop (see pumps.c) */
+                pumps_run(&dpx);
+        } else {
+                /* Open the control channel as publisher */
+                dpx_open(&dpx, CHANNEL("control"), CH_NEW | CH_PUB);
 
-        /* Enter the loop driver */
-        pumpd(&dpx);
+                /* Enter the loop driver */
+                pumpd(&dpx);
+        }
 }
 
 
@@ -159,26 +175,98 @@ void pumpd_stop(void)
                 bye("pumpd is not running.");
 
         remove(PID_PATH);
+        remove(STAT_PATH);
         dpx_remove(CHANNEL("control"));
 
         kill(pid, SIGTERM);
 }
 
 
+/**
+ * pumpd_alive
+ * ```````````
+ * Check whether the process that wrote a stat file is still running.
+ *
+ * @path : path of the stat file
+ * Return: false if it is gone, or the file is, otherwise true.
+ *
+ * NOTE
+ * A pump that is killed outright, or crashes, never removes its stat
+ * file, and without this its last figures would be counted forever.
+ */
+static bool pumpd_alive(const char *path)
+{
+        FILE *f;
+        int pid = 0;
+
+        if (!(f = fopen(path, "r")))
+                return false;
+
+        if (fscanf(f, "pid %d", &pid) != 1)
+                pid = 0;
+
+        fclose(f);
+
+        return pid > 0 && !(kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+
 /**
  * pumpd_stat 
  * ``````````
  * Print the status of the pump daemon to stdout
  *
  * Return: nothing.
+ *
+ * NOTES
+ * The status is printed as "key value" lines (see stats.c), for scripts
+ * to pick apart. In fork mode, each pump process keeps a stat file of its
+ * own next to the daemon's, and the counters of those still running are
+ * added up.
  */
 void pumpd_stat(void)
 {
+        struct stats_t total = {};
+        struct stats_t one;
+        struct diter_t d;
+        char path[PATHSIZE];
+        char val[LINESIZE];
+        const char *name;
         int pid;
+
         if (pid = pidfile(PID_PATH, "r"), !pid)
                 bye("pumpd is not running.");
-        else    
-                bye("pumpd is running with pid %d.", pid);
+
+        printf("pid %d\n", pid);
+
+        if (exists(STAT_PATH)) {
+                get_token(val, "mode", STAT_PATH);
+                printf("mode %s\n", val);
+                get_token(val, "forked", STAT_PATH);
+                printf("forked %s\n", val);
+        }
+
+        if (!diter_open(&d, CFG_PATH, F_REG, D_FLAT))
+                bye("Could not open directory %s", CFG_PATH);
+
+        while ((name = diter_next(&d))) {
+                if (strncmp(name, STAT_NAME, strlen(STAT_NAME)) != 0)
+                        continue;
+
+                if (snprintf(path, PATHSIZE, "%s/%s", CFG_PATH, name) >= PATHSIZE)
+                        continue;
+
+                /* Left behind by a pump that died */
+                if (!pumpd_alive(path))
+                        continue;
+
+                if (stats_read(path, &one))
+                        stats_merge(&total, &one);
+        }
+
+        diter_close(&d);
+
+        stats_write(stdout, &total);
 }
 
 
@@ -192,7 +280,7 @@ int main(int argc, char *argv[])
                 usage();
 
         else if (isarg(1, "start"))
-                pumpd_start();
+                pumpd_start((argc > 2 && isarg(2, "fork")) ? P_FORK : P_KEEP);
 
         else if (isarg(1, "stop"))
                 pumpd_stop();
@@ -13,10 +13,18 @@
 "  OPTIONS                                                              \n"\
 "         The following options are supported:                          \n"\
 "                                                                       \n"\
-"         start        start the daemon if it is not already running    \n"\
+"         start [keep|fork]                                             \n"\
+"                      start the daemon if it is not already running.   \n"\
+"                      With keep (the default), one process serves      \n"\
+"                      every pump; with fork, each pump gets its own.   \n"\
 "         stop         stop the daemon if it is running                 \n"\
 "         restart      stop and then start the daemon                   \n"\
-"         stat         print the current status of the daemon           \n"\
+"         stat         print the current status of the daemon: the      \n"\
+"                      number of pumps and clients it is serving, and   \n"\
+"                      counters of files scanned, sent and acked, with  \n"\
+"                      p50/p99 of scan time and of time from a file's   \n"\
+"                      mtime to its name being sent, as \"key value\"    \n"\
+"                      lines                                            \n"\
 "         help         print this screen                                \n"\
 "                                                                       \n"\
 "  OTHER                                                                \n"\
@@ -5,6 +5,9 @@
 #include <stdarg.h>
 #include <signal.h>
 #include <string.h>
+#include <libgen.h>
+
+#include <sys/stat.h>
 
 #include "eo.h"
 #include "meta.h"
@@ -13,6 +16,7 @@
 #include "common/io/file.h"
 #include "common/io/dir.h"
 #include "common/io/shell.h"
+#include "common/io/exec.h"
 #include "common/ipc/daemon.h"
 #include "common/ipc/channel.h"
 
@@ -33,10 +37,11 @@
  *
  * These functions define operations that are bound to the operator tokens
  * in the symbol table. Each of them conforms to a single prototype, taking
- * two parameters:
+ * three parameters:
  *
  *      1. Pointer to an operation object (struct op_t).
- *      2. Pointer to a mutable filename string.
+ *      2. Pointer to the state of the caller (struct opctx_t).
+ *      3. Pointer to a mutable filename string.
  *
  * Any static data about the operation to be performed will be contained in
  * the operation object. Things such as which shell command to run, or which
@@ -47,37 +52,84 @@
  * operation will receive a pointer to the filename, etc., and it will be
  * transformed through successive operations.
  *
+ * Output goes to the stream in the caller's state, and a command that can
+ * take many filenames at once may be deferred to a batch there, which the
+ * caller must flush with op_flush() when it runs out of files, or before
+ * it waits for more.
+ *
  ******************************************************************************/
 
 
 /**
  * eo_nextfile 
  * ```````````
- * Yield filenames from a directory.
+ * Yield filenames from the directory of a routine.
  * 
- * @directory: Path to a directory 
+ * @r        : the routine, which keeps the state of the iteration
  * @filename : Name of the current file (altered by eo_nextfile).
- * Return    : 0 on success, -1 on failure.
+ * Return    : 1 on success, -1 on failure.
  */
-int eo_nextfile(char *directory, char **filename)
+int eo_nextfile(struct routine_t *r, char **filename)
 {
-        static DIR *dir;
-
         /* First invocation */
-        if (dir == NULL) {
-                make_path_absolute(directory);
-                dir = sdopen(directory); // open the directory
+        if (!r->iter_open) {
+                make_path_absolute(r->path);
+                if (!diter_open(&r->iter, r->path, F_REG, D_FLAT))
+                        bye("Could not open directory %s", r->path);
+                r->iter_open = true;
         }
 
-        if ((*filename = getfile(dir, F_REG))) {
+        if ((*filename = (char *)getfile(&r->iter))) {
                 return 1;
         } else {
-                sdclose(dir);
+                diter_close(&r->iter);
+                r->iter_open = false;
                 return -1;
         }
 }
 
 
+/**
+ * op_prep
+ * ```````
+ * Prepare an operation for execution, once, at parse time.
+ *
+ * @op   : the operation, with its operand filled in
+ * Return: nothing.
+ *
+ * NOTES
+ * Whatever an operation needs to work out from its operand, it should
+ * work out here and keep in the operation object, rather than in static
+ * variables of its own. That way the operation can be run by any number 
+ * of workers at once (see pool.c).
+ *
+ * For op_sub, the operand is split around the {pattern} token into
+ * the text on the left, the pattern, and the text on the right, and the
+ * pattern is compiled (see regex.c).
+ */
+void op_prep(struct op_t *op)
+{
+        char match[PATHSIZE] = "";
+        char *l;
+        char *r;
+
+        op->lside[0] = op->rside[0] = '\0';
+
+        if (op->op == op_sub) {
+                if (!(l = strchr(op->operand, '{')) || !(r = strchr(l, '}'))) {
+                        slcpy(op->lside, op->operand, LINESIZE);
+                } else {
+                        slcpy(op->lside, op->operand, min_t(size_t, l - op->operand + 1, LINESIZE));
+                        slcpy(match,     l + 1,       min_t(size_t, r - l, PATHSIZE));
+                        slcpy(op->rside, r + 1,       LINESIZE);
+
+                        if (STREMPTY(match))
+                                match[0] = '*';
+                }
+        }
+
+        pat_compile(&op->match, match);
+}
 
 
 /**
@@ -85,11 +137,12 @@ int eo_nextfile(char *directory, char **filename)
  * ``````
  * A do-nothing function stub for when there is no operation. 
  * 
- * @operand : operand (can be NULL) 
+ * @op      : operation object
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 0 on success, -1 on failure.
  */
-int op_voi(char *operand, char **filename)
+int op_voi(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
         return 1;
 }
@@ -100,22 +153,42 @@ int op_voi(char *operand, char **filename)
  * ``````
  * Perform an in-place rename (mv).
  * 
- * @operand : Desired (target) filename or directory of file. 
+ * @op      : operation object; the operand is the desired (target) 
+ *            filename or directory of file. 
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
- * Return   : 1 on success, -1 on failure.
+ * Return   : 1 on success, 0 on failure.
+ *
+ * NOTE
+ * As with mv(1), if the target is a directory, the file is moved into
+ * it under its own name. This is done with rename(2), not by running mv,
+ * so it only works within a filesystem.
  */
-int op_mov(char *operand, char **filename)
+int op_mov(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
-        static char result[LINESIZE];
+        char result[PATHSIZE];
+        struct stat st;
+        int len = 0;
+
+        if (stat(op->operand, &st) == 0 && S_ISDIR(st.st_mode))
+                len = snprintf(result, PATHSIZE, "%s/%s", op->operand, basename(*filename));
+        else
+                slcpy(result, op->operand, PATHSIZE);
+
+        /* Never move a file to a truncated name. */
+        if (len >= PATHSIZE) {
+                fprintf(ctx->out, "mv: %s: %s\n", *filename, strerror(ENAMETOOLONG));
+                return 0;
+        }
 
-        if (bounce(result, LINESIZE, "mv %s %s", *filename, operand)) {
-                srename(*filename, result);
-                slcpy(*filename, result, PATHSIZE);
-                return 1;
-        } else {
-                printf("%s\n", result);
+        if (rename(*filename, result) == -1) {
+                fprintf(ctx->out, "mv: %s: %s\n", *filename, strerror(errno));
                 return 0;
         }
+
+        slcpy(*filename, result, PATHSIZE);
+
+        return 1;
 }
 
 
@@ -124,11 +197,12 @@ int op_mov(char *operand, char **filename)
  * ``````
  * Print the value of the expression on the screen. 
  * 
- * @operand : ? 
+ * @op      : operation object
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 1 on success, -1 on failure.
  */
-int op_pat(char *operand, char **filename)
+int op_pat(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
         return 1;
 }
@@ -139,13 +213,14 @@ int op_pat(char *operand, char **filename)
  * ``````
  * Print the value of the expression on the screen. 
  * 
- * @operand : ? 
+ * @op      : operation object
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 1 on success, -1 on failure.
  */
-int op_log(char *operand, char **filename)
+int op_log(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
-        printf("%s\n", *filename);
+        fprintf(ctx->out, "%s\n", *filename);
 
         return 1;
 }
@@ -154,35 +229,53 @@ int op_log(char *operand, char **filename)
 /**
  * op_shl
  * ``````
- * @operand : shell command
+ * @op      : operation object; the operand is a shell command
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 1 on success, -1 on failure.
  */
-int op_shl(char *operand, char **filename)
+int op_shl(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
-        return echo("%s", operand) ? 1 : 0;
+        return fecho(ctx->out, "%s", op->operand) ? 1 : 0;
 }
 
 
 /**
  * op_imp
  * ``````
- * @operand : ? 
+ * @op      : operation object
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 1 on success, -1 on failure.
  */
-int op_imp(char *operand, char **filename)
+int op_imp(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
         return 1;
 }
 
 
+/**
+ * op_out
+ * ``````
+ * Give the stream that the output of a batch should go to now.
+ *
+ * @ctx  : per-worker state
+ * Return: the caller's stream, or stdout between jobs.
+ */
+static FILE *op_out(struct opctx_t *ctx)
+{
+        return ctx->out ? ctx->out : stdout;
+}
+
+
 /**
  * op_sub
  * ``````
  * Conditionally substitute the filename value for the token {}. 
  * 
- * @operand : pattern expression to match each filename against.
+ * @op      : operation object; the operand contains the pattern 
+ *            expression to match each filename against.
+ * @ctx     : per-worker state
  * @filename: name of the current file (may be altered).
  * Return   : 0 on success, -1 on failure.
  *
@@ -195,43 +288,56 @@ int op_imp(char *operand, char **filename)
  *
  * The token need not be used on its own, but will expand in whatever
  * statement it is contained within.
+ *
+ * When the token ends the statement and the caller has asked for it
+ * (eo -x), the command is run once for many files, as with xargs(1).
+ * A statement that is nothing but the token has no command to batch,
+ * and is echoed per file as before.
+ *
+ * NOTE
+ * The operand has already been split up, and the pattern compiled,
+ * by op_prep().
  */
-int op_sub(char *operand, char **filename)
+int op_sub(struct op_t *op, struct opctx_t *ctx, char **filename)
 {
-        static bool first = true;
-        static char match[PATHSIZE];
-        static char lside[LINESIZE];
-        static char rside[LINESIZE];
-        char *tmp;
-        int i;
-
-        if (first) {
-                tmp = operand;
-
-                for (i=0; *tmp != '{'; i++, tmp++)
-                        lside[i] = *tmp;
-
-                tmp++;
-
-                for (i=0; *tmp != '}'; i++, tmp++)
-                        match[i] = *tmp;
-
-                tmp++;
-
-                for (i=0; *tmp != '\0'; i++, tmp++)
-                        rside[i] = *tmp;
-
-                first = false;
-        }
-
-        if (STREMPTY(match))
-                match[0] = '*';
+        if (!pat_match(&op->match, *filename))
+                return 1;
 
-        if (kleene(match, *filename)) {
-                echo("%s %s %s", lside, *filename, rside);
+        if (ctx->xargs && STREMPTY(op->rside) && !exec_empty(op->lside)) {
+                if (ctx->batch_op != op) {
+                        op_flush(ctx);
+                        xbatch_open(&ctx->batch, op->lside, op_out(ctx));
+                        ctx->batch_op = op;
+                }
+                ctx->batch.out = op_out(ctx);
+                xbatch_add(&ctx->batch, *filename);
+        } else {
+                fecho(ctx->out, "%s %s %s", op->lside, *filename, op->rside);
         }
 
         return 1;
 }
 
 
+/**
+ * op_flush
+ * ````````
+ * Run whatever commands have been deferred to a batch.
+ *
+ * @ctx  : per-worker state
+ * Return: nothing.
+ *
+ * CAVEAT
+ * A batch spans many files, so its output can not be put in the place
+ * of any one of them; it goes to the caller's stream as it stands when
+ * the batch runs (stdout if there is none at the time).
+ */
+void op_flush(struct opctx_t *ctx)
+{
+        if (ctx->batch_op) {
+                ctx->batch.out = op_out(ctx);
+                xbatch_close(&ctx->batch);
+                ctx->batch_op = NULL;
+        }
+}
+
@@ -1,9 +1,29 @@
 #ifndef _OPERATIONS_H
 #define _OPERATIONS_H
 
+#include <stdio.h>
+#include <stdbool.h>
 #include "lex.h"
+#include "common/io/file.h"
+#include "common/io/exec.h"
+#include "regex.h"
 
-typedef int (*opf_t)(char *operand, char **filename);
+struct op_t;
+struct routine_t;
+
+/*
+ * Per-worker operation state. Each thread running operations has its
+ * own, so that the operations themselves need keep no state of their own.
+ */
+struct opctx_t {
+        FILE *out;             // where the output of the operations goes
+        char file[PATHSIZE];   // the filename being operated on
+        bool xargs;            // batch commands where possible (see op_sub)
+        struct xbatch_t batch; // the batch, if any...
+        const struct op_t *batch_op; // ...and the operation it belongs to
+};
+
+typedef int (*opf_t)(struct op_t *op, struct opctx_t *ctx, char **filename);
 
 /*
  * Single operation type
@@ -12,18 +32,25 @@ struct op_t {
         enum op_tag tag;
         opf_t op;
         char operand[4096];
+        /* Split from the operand at parse time (see op_prep) */
+        char lside[LINESIZE];
+        struct pat_t match;
+        char rside[LINESIZE];
 };
 
 
-int eo_nextfile(char *directory, char **filename);
+int eo_nextfile(struct routine_t *r, char **filename);
+
+void op_prep(struct op_t *op);
+void op_flush(struct opctx_t *ctx);
 
-int op_voi(char *operand, char **filename);
-int op_sub(char *operand, char **filename);
-int op_pat(char *operand, char **filename);
-int op_log(char *operand, char **filename);
-int op_shl(char *operand, char **filename);
-int op_mov(char *operand, char **filename);
-int op_imp(char *operand, char **filename);
+int op_voi(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_sub(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_pat(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_log(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_shl(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_mov(struct op_t *op, struct opctx_t *ctx, char **filename);
+int op_imp(struct op_t *op, struct opctx_t *ctx, char **filename);
 
 
 static opf_t OP[20];
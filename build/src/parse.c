@@ -73,6 +73,7 @@ struct op_t *semantic_analyzer(const char *statement)
                         break;
                 }
                 new->op  = OP[s];
+                op_prep(new);
                 #if defined(SHOW_PARSE)
                 printf("%d (%s): %s\n", s, op_name[s], new->operand);
                 #endif
@@ -113,6 +114,8 @@ struct routine_t *parser_analyzer(const char *input)
         new->n  = (ntok(input, DELIM))+1; // fencepost
         new->op = malloc(new->n * sizeof(struct op_t *));
 
+        new->iter_open = false;
+
         for (statement = strtok(code, DELIM); 
              statement; 
              statement = strtok(NULL, DELIM))
@@ -1,7 +1,9 @@
 #ifndef _PARSER_H 
 #define _PARSER_H 
 
+#include <stdbool.h>
 #include "ops.h"
+#include "common/io/dir.h"
 
 /*
  * Entire routine type 
@@ -10,6 +12,8 @@ struct routine_t {
         int n;
         char path[PATHSIZE];
         struct op_t **op;
+        struct diter_t iter;  // files of 'path' (see eo_nextfile)
+        bool iter_open;       // whether 'iter' is open
 };
 
 
@@ -0,0 +1,395 @@
+#define USE_ERRNO_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pool.h"
+#include "ops.h"
+#include "parse.h"
+
+#include "common/error.h"
+#include "common/textutils.h"
+#include "common/ipc/thread.h"
+
+
+/******************************************************************************
+ * WORKER POOL
+ *
+ * With -j N, eo runs its routine on N files at once, one per worker thread.
+ * The files are put into the pool by a single producer (the directory walk,
+ * or the channel from the pump), and each worker runs the operations of
+ * the routine on the files it is given, start to finish.
+ *
+ * Scheduling
+ * ----------
+ *
+ * Each worker has a deque of its own, with a lock of its own. The producer
+ * deals jobs out round-robin, onto the tail of each deque. A worker takes
+ * jobs from the head of its own deque, and when that runs dry, it steals
+ * from the tail of somebody else's. So long as every worker is busy, the
+ * only contention is between a worker and the producer; a slow file only
+ * holds up the worker that got it, because the others will steal around it.
+ *
+ * A count of queued jobs, kept under the pool lock, is what the workers
+ * sleep on. A worker that takes one from the count is owed a job, and will
+ * find it in some deque.
+ *
+ * Output
+ * ------
+ *
+ * Operations write their output to the stream in their opctx_t, which for
+ * each job is a memory buffer. When the job is done, the buffer is written
+ * to stdout, under the pool lock, so that no two jobs are interleaved.
+ *
+ * With POOL_ORDERED (the default), buffers are written in the order the
+ * files were put, exactly as a serial run would have written them. Jobs
+ * that finish early wait their turn in the reorder window. The window has
+ * one slot for each job that may be in flight (POOL_DEPTH per worker), and
+ * pool_put() blocks while it is full, which bounds memory no matter how far
+ * ahead of a slow job the others run.
+ *
+ * With POOL_UNORDERED, buffers are written as soon as they are finished.
+ *
+ * With POOL_XARGS, each worker keeps a batch of its own, and runs it when
+ * it is full or when the pool is closed; that output is not ordered.
+ *
+ * CAVEAT
+ * Operations that depend on files processed before them (e.g. moving two
+ * files to the same name) will race, as they would with xargs -P.
+ *
+ ******************************************************************************/
+
+
+/**
+ * deque_put
+ * `````````
+ * Put a job on the tail of a deque.
+ *
+ * @dq   : pointer to a deque
+ * @seq  : sequence number of the job
+ * @file : file to run the routine on
+ * Return: true if the job was put, false if the deque is full.
+ */
+static bool deque_put(struct deque_t *dq, long seq, const char *file)
+{
+        struct job_t *job;
+
+        pth_lock(&dq->lock);
+
+        if (dq->tail - dq->head == POOL_DEPTH) {
+                pth_unlock(&dq->lock);
+                return false;
+        }
+
+        job = &dq->ring[dq->tail % POOL_DEPTH];
+        job->seq = seq;
+        slcpy(job->file, file, PATHSIZE);
+        dq->tail++;
+
+        pth_unlock(&dq->lock);
+
+        return true;
+}
+
+
+/**
+ * deque_take
+ * ``````````
+ * Take a job from the head (own) or the tail (steal) of a deque.
+ *
+ * @dq   : pointer to a deque
+ * @job  : destination of the job
+ * @steal: take from the tail instead of the head
+ * Return: true if a job was taken, false if the deque is empty.
+ */
+static bool deque_take(struct deque_t *dq, struct job_t *job, bool steal)
+{
+        pth_lock(&dq->lock);
+
+        if (dq->tail == dq->head) {
+                pth_unlock(&dq->lock);
+                return false;
+        }
+
+        if (steal)
+                *job = dq->ring[--dq->tail % POOL_DEPTH];
+        else
+                *job = dq->ring[dq->head++ % POOL_DEPTH];
+
+        pth_unlock(&dq->lock);
+
+        return true;
+}
+
+
+/**
+ * pool_retire
+ * ```````````
+ * Hand the output of a finished job to the pool, and write whatever can be.
+ *
+ * @pool : pointer to a pool
+ * @seq  : sequence number of the job
+ * @buf  : output of the job (freed here)
+ * @len  : length of the output
+ * Return: nothing.
+ */
+static void pool_retire(struct pool_t *pool, long seq, char *buf, size_t len)
+{
+        long i;
+
+        pth_lock(&pool->lock);
+
+        if (pool->mode & POOL_UNORDERED) {
+                fwrite(buf, 1, len, stdout);
+                free(buf);
+                pool->retired++;
+        } else {
+                i = seq % pool->window;
+
+                pool->out[i]    = buf;
+                pool->outlen[i] = len;
+                pool->done[i]   = true;
+
+                /* Write out the run of finished jobs at the front */
+                while (pool->done[(i = pool->retired % pool->window)]) {
+                        fwrite(pool->out[i], 1, pool->outlen[i], stdout);
+                        free(pool->out[i]);
+                        pool->out[i]  = NULL;
+                        pool->done[i] = false;
+                        pool->retired++;
+                }
+        }
+
+        pth_broadcast(&pool->room);
+        pth_unlock(&pool->lock);
+}
+
+
+/**
+ * pool_run
+ * ````````
+ * Run the routine on the file of a job.
+ *
+ * @w    : pointer to the worker running the job
+ * @job  : the job
+ * Return: nothing.
+ */
+static void pool_run(struct worker_t *w, struct job_t *job)
+{
+        struct routine_t *r = w->pool->r;
+        char *filename;
+        char *buf = NULL;
+        size_t len = 0;
+        int i;
+
+        if (!(w->ctx.out = open_memstream(&buf, &len)))
+                bye("pool: Could not open output buffer");
+
+        slcpy(w->ctx.file, job->file, PATHSIZE);
+        filename = w->ctx.file;
+
+        for (i=w->pool->first; i<r->n; i++) {
+                r->op[i]->op(r->op[i], &w->ctx, &filename);
+        }
+
+        fclose(w->ctx.out);
+        w->ctx.out = NULL;
+
+        pool_retire(w->pool, job->seq, buf, len);
+}
+
+
+/**
+ * pool_worker
+ * ```````````
+ * The body of a worker thread.
+ *
+ * @arg  : pointer to the worker
+ * Return: NULL.
+ */
+static void *pool_worker(void *arg)
+{
+        struct worker_t *w = arg;
+        struct pool_t *pool = w->pool;
+        struct job_t job;
+        int i;
+
+        for (;;) {
+                pth_lock(&pool->lock);
+
+                /* 
+                 * Nothing queued: run what we have batched before we wait,
+                 * or a pump that has gone quiet would hold it forever.
+                 */
+                if (pool->queued == 0 && !pool->closing && w->ctx.batch_op) {
+                        pth_unlock(&pool->lock);
+                        op_flush(&w->ctx);
+                        continue;
+                }
+
+                while (pool->queued == 0 && !pool->closing)
+                        pth_wait(&pool->work, &pool->lock);
+
+                if (pool->queued == 0) {
+                        /* Closing, and nothing left to do */
+                        pth_unlock(&pool->lock);
+                        break;
+                }
+                pool->queued--;
+
+                pth_unlock(&pool->lock);
+
+                /* 
+                 * Our own first, then steal round the others. The job we
+                 * are owed may be taken by a thief who is owed one put
+                 * behind us, so go round until we have one.
+                 */
+                for (i=0; ; i=(i+1) % pool->n) {
+                        if (deque_take(&pool->worker[(w->id + i) % pool->n].deque, &job, i != 0))
+                                break;
+                }
+
+                pool_run(w, &job);
+        }
+
+        op_flush(&w->ctx);
+
+        return NULL;
+}
+
+
+/******************************************************************************
+ * PUBLIC
+ ******************************************************************************/
+
+/**
+ * pool_new
+ * ````````
+ * Start a pool of workers to run a routine.
+ *
+ * @r       : the routine
+ * @first   : index of the first operation of the routine to run
+ * @nworkers: number of worker threads
+ * @mode    : POOL_ORDERED or POOL_UNORDERED, and optionally POOL_XARGS
+ * Return   : pointer to a running pool.
+ */
+struct pool_t *pool_new(struct routine_t *r, int first, int nworkers, int mode)
+{
+        struct pool_t *pool;
+        int i;
+
+        if (nworkers < 1 || nworkers > POOL_MAX)
+                bye("pool: Number of workers must be between 1 and %d", POOL_MAX);
+
+        if (!(pool = calloc(1, sizeof(struct pool_t))))
+                bye("pool: Out of memory");
+
+        pool->r      = r;
+        pool->first  = first;
+        pool->n      = nworkers;
+        pool->mode   = mode;
+        pool->window = nworkers * POOL_DEPTH;
+
+        pthread_mutex_init(&pool->lock, NULL);
+        pth_cond_init(&pool->work);
+        pth_cond_init(&pool->room);
+
+        pool->worker = calloc(nworkers, sizeof(struct worker_t));
+        pool->out    = calloc(pool->window, sizeof(char *));
+        pool->outlen = calloc(pool->window, sizeof(size_t));
+        pool->done   = calloc(pool->window, sizeof(bool));
+
+        if (!pool->worker || !pool->out || !pool->outlen || !pool->done)
+                bye("pool: Out of memory");
+
+        /* Anything already buffered would come out after the jobs */
+        fflush(stdout);
+
+        for (i=0; i<nworkers; i++) {
+                pool->worker[i].pool = pool;
+                pool->worker[i].id   = i;
+                pool->worker[i].ctx.xargs = (mode & POOL_XARGS) != 0;
+                pthread_mutex_init(&pool->worker[i].deque.lock, NULL);
+                init_pth(&pool->worker[i].pth, pool_worker);
+        }
+
+        for (i=0; i<nworkers; i++)
+                pth_fork(&pool->worker[i].pth, &pool->worker[i]);
+
+        return pool;
+}
+
+
+/**
+ * pool_put
+ * ````````
+ * Give a file to the pool.
+ *
+ * @pool : pointer to a running pool
+ * @file : file to run the routine on
+ * Return: nothing.
+ *
+ * NOTE
+ * Blocks while the pool has as many jobs in flight as it has room for.
+ */
+void pool_put(struct pool_t *pool, const char *file)
+{
+        long seq;
+        int i;
+
+        pth_lock(&pool->lock);
+
+        while (pool->submitted - pool->retired >= pool->window)
+                pth_wait(&pool->room, &pool->lock);
+
+        seq = pool->submitted++;
+
+        /*
+         * With fewer than 'window' jobs in flight, some deque has room,
+         * and it is usually the next one round.
+         */
+        for (i=0; i<pool->n; i++) {
+                if (deque_put(&pool->worker[pool->next].deque, seq, file))
+                        break;
+                pool->next = (pool->next + 1) % pool->n;
+        }
+        pool->next = (pool->next + 1) % pool->n;
+
+        pool->queued++;
+        pth_signal(&pool->work);
+
+        pth_unlock(&pool->lock);
+}
+
+
+/**
+ * pool_del
+ * ````````
+ * Finish every job in a pool, then stop its workers and free it.
+ *
+ * @pool : pointer to a running pool
+ * Return: nothing.
+ */
+void pool_del(struct pool_t *pool)
+{
+        int i;
+
+        pth_lock(&pool->lock);
+        pool->closing = true;
+        pth_broadcast(&pool->work);
+        pth_unlock(&pool->lock);
+
+        for (i=0; i<pool->n; i++)
+                pth_join(&pool->worker[i].pth, NULL);
+
+        fflush(stdout);
+
+        free(pool->worker);
+        free(pool->out);
+        free(pool->outlen);
+        free(pool->done);
+        free(pool);
+}
+
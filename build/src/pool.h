@@ -0,0 +1,74 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stdbool.h>
+
+#include "ops.h"
+#include "parse.h"
+#include "common/io/file.h"
+#include "common/ipc/thread.h"
+
+
+/* Limits
+``````````````````````````````````````````````````````````````````````````````*/
+#define POOL_DEPTH (64)  // jobs per worker, queued or in flight
+#define POOL_MAX   (256) // most workers in a pool
+
+
+/* Modes
+``````````````````````````````````````````````````````````````````````````````*/
+#define POOL_ORDERED   0x00 // output in the order the files were put
+#define POOL_UNORDERED 0x01 // output in the order the files were finished
+#define POOL_XARGS     0x02 // let workers batch commands (see op_sub)
+
+
+/* Pool
+``````````````````````````````````````````````````````````````````````````````*/
+struct job_t {
+        long seq;              // order in which the job was put
+        char file[PATHSIZE];   // file to run the routine on
+};
+
+struct deque_t {
+        pth_mutex lock;
+        struct job_t ring[POOL_DEPTH];
+        long head;             // owner takes from here
+        long tail;             // producer puts, and thieves steal, here
+};
+
+struct worker_t {
+        struct pool_t *pool;
+        struct pth_t pth;
+        struct deque_t deque;
+        struct opctx_t ctx;
+        int id;
+};
+
+struct pool_t {
+        struct routine_t *r;
+        int first;             // index of the first op to run
+        int n;                 // number of workers
+        int mode;              // POOL_ORDERED or POOL_UNORDERED, | POOL_XARGS
+        struct worker_t *worker;
+        pth_mutex lock;
+        pth_cond work;         // signalled when a job is queued
+        pth_cond room;         // signalled when a job is retired
+        long queued;           // jobs waiting in the deques
+        long submitted;        // jobs put
+        long retired;          // jobs whose output has been written
+        long next;             // worker to give the next job to
+        bool closing;
+        /* Reorder window, indexed by seq */
+        long window;
+        char  **out;
+        size_t *outlen;
+        bool   *done;
+};
+
+
+struct pool_t *pool_new(struct routine_t *r, int first, int nworkers, int mode);
+void           pool_put(struct pool_t *pool, const char *file);
+void           pool_del(struct pool_t *pool);
+
+
+#endif
@@ -1,10 +1,16 @@
 #define __MERSENNE__
+#define USE_ERRNO_H
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <sys/epoll.h>
 
 #include "eod.h"
 #include "pumps.h"
@@ -16,9 +22,12 @@
 
 #include "common/io/file.h"
 #include "common/io/dir.h"
+#include "common/io/watch.h"
+#include "common/io/seen.h"
 
 #include "common/configfiles.h"
 #include "common/textutils.h"
+#include "common/stats.h"
 
 
 /******************************************************************************
@@ -39,21 +48,44 @@
  * a single input, and can leave the marshalling and juggling to the pump 
  * process. 
  *
+ * That is P_FORK. With P_KEEP, the daemon forks nothing: every pump lives
+ * in the daemon's own process, and they are all served from one epoll
+ * loop; see "MULTIPLEXED PUMPS" below.
+ *
  ******************************************************************************/
 
+/*
+ * What an epoll event is for; the first member of whatever it points to
+ */
+#define EV_DEAD    0 // freed at the end of this round of events
+#define EV_CONTROL 1 // the control channel of the daemon
+#define EV_PUMP    2 // the directory watch of a pump
+#define EV_CLIENT  3 // the channel of a subscriber
+
+
 /*
  * The pump object datatype (PRIVATE)
  */
 
 struct pump_t {
+        int kind;                // EV_PUMP (see pumps_run)
         int mode;                // Used by pump daemon
         struct cwd_t breadcrumb; // Tracks working directory
         struct dpx_t dpx;        // Duplex channel link
         struct pth_t watcher;    // Watcher thread for DIR I/O 
         char target[PATHSIZE];   // Directory to be pumped
         char channel[PATHSIZE];  // Channel identification string
-        DIR *dir;                // Where the money comes out
-        int  dir_fd;             // File descriptor version of above
+        struct diter_t iter;     // Where the money comes out
+        int  dir_fd;             // File descriptor of the above
+        struct watch_t watch;    // Notifies us of new arrivals in iter
+        char key[SEEN_KEY+1];    // Names the subscriber's checkpoint
+        /* pump_files() only */
+        struct seen_t *seen;     // Files already sent to the client
+        long sent;               // Names sent to the client...
+        long acked;              // ...and acknowledged by it
+        /* P_KEEP only */
+        struct client_t *clients;// Everyone subscribed to the target
+        struct pump_t *next;     // Next pump in this process
 };
 
 
@@ -68,6 +100,178 @@ struct pump_t {
 struct pump_t *current_pump;
 
 
+/*
+ * The same goes for the counters (see stats.c). In fork mode they are
+ * those of the one pump in the process; in keep mode, of all of them.
+ */
+static struct stats_t stats;
+static uint64_t stats_last; // when they were last written (monotonic usec)
+static bool stats_dirty;    // ...and whether they have changed since
+
+
+/*
+ * The clock at the start of a scan
+ */
+struct mark_t {
+        uint64_t start;         // monotonic, for scan_us
+};
+
+
+/**
+ * stat_begin
+ * ``````````
+ * Take note of the time before a scan.
+ *
+ * @m    : destination of the notes
+ * Return: nothing.
+ */
+static void stat_begin(struct mark_t *m)
+{
+        m->start = usec_now(CLOCK_MONOTONIC);
+}
+
+
+/**
+ * stat_lag
+ * ````````
+ * Count the time from a file's last modification to its name being sent.
+ *
+ * @mtime: the file's mtime (realtime usec)
+ * Return: nothing.
+ *
+ * NOTE
+ * Call this once the name is on the channel, not when it is found; in
+ * keep mode a name may wait on a backlog for credit in between.
+ */
+static inline void stat_lag(uint64_t mtime)
+{
+        uint64_t now = usec_now(CLOCK_REALTIME);
+
+        hist_add(&stats.lag_us, (now > mtime) ? now - mtime : 0);
+}
+
+
+/**
+ * stat_seen
+ * `````````
+ * Test a file against a seen-set, and count it.
+ *
+ * @seen : pointer to a seen-set
+ * @st   : stat of the file
+ * Return: true if the file is new (see seen_add()).
+ *
+ * NOTE
+ * This counts a file once per seen-set. For a file that goes to all the
+ * subscribers of a pump, see pump_send().
+ */
+static inline bool stat_seen(struct seen_t *seen, const struct stat *st)
+{
+        stats.scanned++;
+
+        if (seen_add(seen, st))
+                return true;
+
+        stats.seen_hits++;
+        return false;
+}
+
+
+/**
+ * stat_ack
+ * ````````
+ * Checkpoint and count the names a subscriber has acknowledged.
+ *
+ * @dpx  : the channel to the subscriber
+ * @seen : the seen-set the names were taken from
+ * @sent : number of names put on the channel so far
+ * @acked: number of them acknowledged so far (updated)
+ * Return: nothing.
+ *
+ * NOTE
+ * Credit is only returned for what the subscriber has consumed (see
+ * channel.c), so whatever is not out on credit has been acknowledged.
+ */
+static void stat_ack(struct dpx_t *dpx, struct seen_t *seen, long sent,
+                     long *acked)
+{
+        long now = sent - (DPX_CREDIT - dpx->credit);
+
+        if (now > *acked) {
+                seen_ack(seen, now - *acked);
+                stats.acked += now - *acked;
+                *acked = now;
+        }
+}
+
+
+/**
+ * stat_end
+ * ````````
+ * Count the time a scan took.
+ *
+ * @m    : notes taken at the start of the scan
+ * Return: nothing.
+ */
+static void stat_end(struct mark_t *m)
+{
+        hist_add(&stats.scan_us, usec_now(CLOCK_MONOTONIC) - m->start);
+}
+
+
+/**
+ * stat_dump
+ * `````````
+ * Write the counters of the process to a stat file.
+ *
+ * @name  : name of the stat file, under CFG_PATH
+ * @mode  : P_KEEP or P_FORK
+ * @forked: number of pump processes forked so far
+ * Return : nothing.
+ *
+ * NOTES
+ * The file is written in full and renamed over the old one, so that a
+ * reader never sees half of it.
+ */
+static void stat_dump(const char *name, int mode, long forked)
+{
+        char path[PATHSIZE];
+        char tmp[PATHSIZE];
+        FILE *f;
+
+        stats_last = usec_now(CLOCK_MONOTONIC);
+
+        if (snprintf(path, PATHSIZE, "%s/%s", CFG_PATH, name) >= PATHSIZE
+         || snprintf(tmp,  PATHSIZE, "%s/.%s", CFG_PATH, name) >= PATHSIZE)
+                return;
+
+        if (!(f = fopen(tmp, "w")))
+                return;
+
+        fprintf(f, "pid %d\n",     (int)getpid());
+        fprintf(f, "mode %s\n",    (mode == P_FORK) ? "fork" : "keep");
+        fprintf(f, "forked %ld\n", forked);
+        stats_write(f, &stats);
+        fclose(f);
+
+        rename(tmp, path);
+}
+
+
+/**
+ * stat_due
+ * ````````
+ * Check whether it is time to write the counters out again.
+ *
+ * Return: milliseconds until it is, or 0 if it is now.
+ */
+static long stat_due(void)
+{
+        uint64_t ms = (usec_now(CLOCK_MONOTONIC) - stats_last) / 1000;
+
+        return (ms >= STAT_INTERVAL) ? 0 : STAT_INTERVAL - ms;
+}
+
+
 /**
  * catch_signal
  * ````````````
@@ -80,6 +284,8 @@ void catch_signal(int signo)
 {
         if (current_pump)
                 kill_pump(current_pump);
+        else
+                pumps_kill();
 
         signal(signo, SIG_DFL);
         raise(signo);
@@ -107,26 +313,114 @@ void register_pump(struct pump_t *p)
  * Create a dynamically-allocated pump object.
  * 
  * @target : the directory to be pumped
+ * @key    : names the checkpoint of the subscriber (see seen_open())
  * @channel: the name of the channel to publish on
  * @mode   : whether to fork the process or not
  * Return  : pointer to an allocated pump object.
  *
  */
-struct pump_t *new_pump(char *target, char *channel, int mode)
+struct pump_t *new_pump(char *target, char *key, char *channel, int mode)
 {
         struct pump_t *new;
 
         new = calloc(1, sizeof(struct pump_t));
 
-        new->mode = mode;
+        new->kind   = EV_PUMP;
+        new->mode   = mode;
+        new->dir_fd = -1;
 
         slcpy(new->target, target, PATHSIZE);
+        slcpy(new->key, key, SEEN_KEY+1);
         slcpy(new->channel, channel, PATHSIZE);
 
         return new;
 }
 
 
+/**
+ * pump_parse
+ * ``````````
+ * Split the request of a subscriber into its target and key.
+ *
+ * @msg   : the request, "<target>\n<key>", or just "<target>"
+ * @target: destination of the target (PATHSIZE)
+ * @key   : destination of the key (SEEN_KEY+1), "" if there is none
+ * Return : nothing.
+ */
+void pump_parse(const char *msg, char *target, char *key)
+{
+        const char *nl = strrchr(msg, '\n');
+        size_t len;
+
+        slcpy(target, msg, PATHSIZE);
+        key[0] = '\0';
+
+        if (nl) {
+                len = ((size_t)(nl - msg) < PATHSIZE) ? nl - msg : PATHSIZE-1;
+                target[len] = '\0';
+                slcpy(key, nl + 1, SEEN_KEY+1);
+        }
+}
+
+
+/**
+ * pump_start
+ * ``````````
+ * Open the directory and the watch of a pump.
+ *
+ * @p    : pointer to a new pump object
+ * Return: false if the directory could not be opened (see errno), and
+ *         nothing is left open, otherwise true.
+ */
+static bool pump_start(struct pump_t *p)
+{
+        long wait;
+
+        /* Open directory iterator */
+        if (!diter_open(&p->iter, p->target, F_REG, D_FLAT))
+                return false;
+
+        p->dir_fd = diter_fd(&p->iter);
+
+        /* Watch it before the first scan, so nothing slips by */
+        wait = pump_wait(p->target);
+
+        if (!watch_open(&p->watch, p->dir_fd, p->target, wait)) {
+                diter_close(&p->iter);
+                p->dir_fd = -1;
+                return false;
+        }
+
+        return true;
+}
+
+
+/**
+ * pump_stop
+ * `````````
+ * Close whatever pump_start() opened.
+ *
+ * @p    : pointer to a pump object
+ * Return: nothing.
+ */
+static void pump_stop(struct pump_t *p)
+{
+        /* Stop watching and close directory iterator if it's open */
+        if (p->dir_fd != -1) {
+                watch_close(&p->watch);
+                diter_close(&p->iter);
+                p->dir_fd = -1;
+        }
+
+        /* Write out the last of the seen-set checkpoint (pump_files()) */
+        if (p->seen) {
+                seen_sync(p->seen);
+                seen_del(p->seen);
+                p->seen = NULL;
+        }
+}
+
+
 /**
  * kill_pump
  * `````````
@@ -136,9 +430,17 @@ struct pump_t *new_pump(char *target, char *channel, int mode)
  */
 void kill_pump(struct pump_t *p)
 {
-        /* Close directory stream if it's open */
-        if (p->dir)
-                sdclose(p->dir);
+        char path[PATHSIZE];
+        int n;
+
+        pump_stop(p);
+
+        /* Take our figures out of 'pumpd stat' */
+        n = snprintf(path, PATHSIZE, "%s/%s.%s",
+                     CFG_PATH, STAT_NAME, p->channel);
+
+        if (n < PATHSIZE)
+                remove(path);
 
         /* Close and unlink files on disk */
         dpx_close(&p->dpx);
@@ -172,52 +474,193 @@ void open_pump(struct pump_t *p)
 
         register_pump(p);
 
-        /* Open a new duplex channel as publisher */
-        dpx_open(&p->dpx, CHANNEL(p->channel), CH_NEW | CH_PUB);
+        /* 
+         * Open the duplex channel as publisher. The daemon creates it
+         * before forking, so that it exists by the time the client is
+         * told where it is.
+         */
+        if (exists(CHANNEL(p->channel)))
+                dpx_open(&p->dpx, CHANNEL(p->channel), CH_PUB);
+        else
+                dpx_open(&p->dpx, CHANNEL(p->channel), CH_NEW | CH_PUB);
 
         /* Enter the loop driver */
         pump_files(p);
 }
 
 
+/**
+ * pump_wait
+ * `````````
+ * Get the polling interval configured for a pumped directory.
+ *
+ * @target: the directory being pumped
+ * Return : the interval in milliseconds.
+ *
+ * NOTES
+ * The interval is the 'wait' field of the pump configuration written by
+ * 'eo init', and is given there in seconds. It is only consulted if the
+ * directory cannot be watched with inotify (see watch.c). A missing or
+ * zero value, or a config whose path is too long to open, gets the
+ * shortest interval the watch will allow.
+ */
+long pump_wait(const char *target)
+{
+        char path[PATHSIZE];
+        char wait[LINESIZE] = "";
+
+        /* Too long to hold the config; treat it as missing */
+        if (snprintf(path, PATHSIZE, "%s/.eo/config", target) >= PATHSIZE)
+                return 0;
+
+        if (exists(path))
+                get_token(wait, "wait", path);
+
+        return (long)(atof(wait) * 1000);
+}
+
+
+/**
+ * pump_put
+ * ````````
+ * Send a name to the client of a pump.
+ *
+ * @p    : pointer to a running pump object
+ * @name : the name
+ * Return: nothing, or does not return if the channel is gone.
+ */
+static void pump_put(struct pump_t *p, const char *name)
+{
+        if (dpx_put(&p->dpx, name) == -1) {
+                kill_pump(p);
+                exit(0);
+        }
+        p->sent++;
+        stats.sent++;
+}
+
+
+/**
+ * pump_credit
+ * ```````````
+ * Take the credit the client of a pump has returned.
+ *
+ * @p    : pointer to a running pump object
+ * Return: nothing, or does not return if the client has hung up or the
+ *         channel is broken.
+ *
+ * NOTE
+ * The channel blocks (it is not CH_NIO), so it is made non-blocking for
+ * as long as it takes to read what has arrived.
+ */
+static void pump_credit(struct pump_t *p)
+{
+        int flags = fcntl(p->dpx.fd_sub, F_GETFL);
+        int type;
+
+        fcntl(p->dpx.fd_sub, F_SETFL, flags | O_NONBLOCK);
+        type = dpx_credit(&p->dpx);
+        fcntl(p->dpx.fd_sub, F_SETFL, flags);
+
+        if (type == FR_NONE || type == FR_ERROR) {
+                kill_pump(p);
+                exit(0);
+        }
+
+        stat_ack(&p->dpx, p->seen, p->sent, &p->acked);
+        seen_sync(p->seen);
+
+        stats_dirty = true;
+}
+
+
+/**
+ * pump_stat
+ * `````````
+ * Write the counters of a forked pump to its own stat file.
+ *
+ * @p    : pointer to a running pump object
+ * Return: nothing.
+ */
+static void pump_stat(struct pump_t *p)
+{
+        char name[PATHSIZE];
+
+        if (snprintf(name, PATHSIZE, "%s.%s", STAT_NAME, p->channel) < PATHSIZE)
+                stat_dump(name, P_FORK, 0);
+
+        stats_dirty = false;
+}
+
+
 /**
  * pump_idle
  * `````````
- * Listen on the open directory file descriptor and nanosleep.
+ * Block until there is something new in the target directory.
  *
  * @p     : pointer to a running pump object
- * @ns    : number of nanoseconds to sleep between stat calls
- * Returns: When the directory has been modified
+ * Returns: W_NAMES if the new names are queued in the watch, W_RESCAN if 
+ *          the directory must be scanned to find them.
  *
  * NOTES
- * The idle loop is pretty simple. The directory's file descriptor
- * is queried using the fstat command, and the st_mtime member of
- * the stat struct is examined. If its value is less than the time
- * recorded when this function was called, the directory contents
- * have not been modified, and we can continue idling. 
+ * The idle pump sleeps in the kernel until the directory watch has an
+ * event for it, so an idle pump costs nothing. If the directory could
+ * not be watched, the watch polls the directory's mtime at the interval
+ * given by pump_wait(), above.
+ *
+ * The channel is watched as well, so that credit returned while we are
+ * idle is taken as the acknowledgement it is (see pump_credit()), and a
+ * hangup ends the pump.
  *
- * USAGE 
- * In practice, long nanoseconds may be hard to find. 
+ * Counters that change while we are idle are written out in time, at most
+ * STAT_INTERVAL after the last write, or 'pumpd stat' would go stale.
  */
-void pump_idle(struct pump_t *p, long nanoseconds)
+int pump_idle(struct pump_t *p)
 {
-        time_t at_start;
-        struct stat buf;
+        struct pollfd pfd[2] = {
+                { .fd = watch_fd(&p->watch), .events = POLLIN }, // -1 polls
+                { .fd = p->dpx.fd_sub,       .events = POLLIN },
+        };
+        long wait;
+        int status;
 
-        at_start = time(NULL);
+        for (;;) {
+                if (stats_dirty && stat_due() == 0)
+                        pump_stat(p);
 
-        /* 
-         * If the file descriptor is rotten, return 
-         * immediately (no sleeping).
-         */
-        if (fstat(p->dir_fd, &buf) == EBADF)
-                return;
+                if (watch_polling(&p->watch))
+                        wait = p->watch.wait;
+                else
+                        wait = watch_due(&p->watch);
+
+                if (stats_dirty && (wait == -1 || stat_due() < wait))
+                        wait = stat_due();
+
+                switch (poll(pfd, 2, (int)wait)) {
+                case -1:
+                        if (errno != EINTR)
+                                bye("pump: Could not wait on %s", p->target);
+                        continue;
+                case 0:
+                        if ((status = watch_check(&p->watch)) == W_NONE)
+                                continue;
+                        goto woke;
+                }
+
+                if (pfd[1].revents)
+                        pump_credit(p);
+
+                if (pfd[0].revents) {
+                        status = watch_wait(&p->watch);
+                        goto woke;
+                }
+        }
 
-        do { 
-                fstat(p->dir_fd, &buf);
-                nsleep(nanoseconds);
+        woke:
+        if (status == W_ERROR)
+                bye("pump: Lost the watch on %s", p->target);
 
-        } while (buf.st_mtime <= at_start);
+        return status;
 }
 
 
@@ -234,14 +677,33 @@ void pump_idle(struct pump_t *p, long nanoseconds)
  * associated with it will only exist for the duration of the client's
  * connection. If a disconnection occurs, the channel and memory will
  * be free'd and the process will be killed. 
+ *
+ * The directory is scanned in full only on the first pass, when the
+ * watch has lost track of events, or when the seen-set is due to be
+ * swept (see seen_stale()). Otherwise the names handed to us by the
+ * watch are sent as they are.
+ *
+ * Names are sent as frames (see channel.c), so there is no need to stop
+ * and wait for the client after each pass; dpx_put() will hold us back
+ * if the client falls too far behind. A name is only checkpointed in the
+ * seen-set once the client has acknowledged it.
  */ 
 void pump_files(struct pump_t *p)
 {
+        const struct stat *st;
+        struct mark_t mark;
         const char *file;
+        uint64_t sent;
+        int status;
+
+        if (!pump_start(p))
+                bye("pump: Could not open %s", p->target);
+
+        /* Pick up where the last pump for this subscriber left off */
+        p->seen = seen_new(SEEN_MAX);
 
-        /* Open directory stream */
-        p->dir     = sdopen(p->target);
-        p->dir_fd  = dirfd(p->dir);
+        if (seen_open(p->seen, p->target, p->key) == -1)
+                bye("pump: Could not open the checkpoint in %s", p->target);
 
         /* Shift working directory to target */
         cwd_shift(&p->breadcrumb, p->target);
@@ -249,29 +711,1120 @@ void pump_files(struct pump_t *p)
         /* Wait for the client to connect to channel */
         dpx_link(&p->dpx);
 
-        rediff:
+        /* From here on, a hangup reads as one (see pump_idle()) */
+        dpx_unkeep(&p->dpx);
 
-        /* 
-         * Write each new filename into the channel. 
-         * Filenames that have already been sent are
-         * not yielded by getdiff, which keeps a Bloom
-         * filter to screen out the double-dippers. 
-         */
-        while ((file = getdiff(p->dir, F_REG))) {
-                dpx_send(&p->dpx, file);
-        }
+        stats.pumps   = 1;
+        stats.clients = 1;
 
-        dpx_send(&p->dpx, "DONE"); // notify client
-        dpx_read(&p->dpx);         // wait for instructions
+        for (status = W_RESCAN;; status = pump_idle(p)) {
+                stat_begin(&mark);
+                sent = stats.sent;
 
-        /*
-         * Idle the pump until the directory contents 
-         * are modified.
-         */
-        pump_idle(p, 100);
-        goto rediff;
+                /* 
+                 * Write each new filename into the channel. 
+                 * Files that have already been sent are
+                 * screened out by the seen-set, which keeps
+                 * track of the double-dippers. 
+                 */
+                if (status != W_RESCAN) {
+                        while ((file = watch_next(&p->watch, F_REG))) {
+                                if (stat_seen(p->seen, &p->watch.st)) {
+                                        pump_put(p, file);
+                                        stat_lag(usec_of(&p->watch.st.st_mtim));
+                                }
+                        }
+
+                        /* Now and then, or the seen-set only ever grows */
+                        if (seen_stale(p->seen))
+                                status = W_RESCAN;
+                }
+
+                if (status == W_RESCAN) {
+                        while ((file = diter_next(&p->iter))) {
+                                if (!(st = diter_stat(&p->iter)))
+                                        continue;
+                                if (stat_seen(p->seen, st)) {
+                                        pump_put(p, file);
+                                        stat_lag(usec_of(&st->st_mtim));
+                                }
+                        }
+
+                        /* Forget files that are no longer there */
+                        seen_sweep(p->seen);
+                }
+
+                /* Flush the batch before going idle */
+                if (dpx_push(&p->dpx) == -1) {
+                        kill_pump(p);
+                        exit(0);
+                }
+
+                /* Checkpoint whatever credit came back along the way */
+                stat_ack(&p->dpx, p->seen, p->sent, &p->acked);
+                seen_sync(p->seen);
+
+                stat_end(&mark);
+                stats.wakeups++;
+                stats.idle += (stats.sent == sent);
+                stats_dirty = true;
+
+                if (stat_due() == 0)
+                        pump_stat(p);
+        }
 
         exit(0);
 }
 
 
+
+
+/******************************************************************************
+ * MULTIPLEXED PUMPS 
+ *
+ * A process per pump is simple, but it does not scale: a daemon pumping a
+ * few hundred directories is a few hundred processes, each with its own
+ * watch, its own scan of the directory, and its own copy of the seen-set,
+ * even when they are all pumping the same directory.
+ *
+ * With P_KEEP, the daemon never forks. It keeps one pump per target
+ * directory, and one client object per subscriber, and waits on all of
+ * them at once with epoll(7):
+ *
+ *      control channel  ---> pumps_request()  new subscriber, maybe new pump
+ *      directory watch  ---> pump_update()    scan, send to all subscribers
+ *      subscriber       ---> client_event()   handshake, credit, hangup
+ *
+ * Every channel is opened with CH_NIO (see channel.c), so it is created,
+ * opened, and ready before the subscriber is told its name, and nothing in
+ * the loop blocks on anyone. Directories that cannot be watched are polled
+ * with watch_check() whenever the loop wakes, which is at least as often
+ * as the shortest polling interval among them.
+ *
+ * Credit keeps a subscriber from falling too far behind, but it counts
+ * names, not bytes, so the FIFO of a subscriber can still fill up. What
+ * did not fit waits in its channel's batch, and the loop waits for the
+ * FIFO to be writable again (see client_push()). Replies on the control
+ * channel are single blocks, and are never waited for (see pumps_reply()).
+ *
+ * Sharing
+ * -------
+ *
+ * Subscribers asking for the same target share its pump, and so its watch,
+ * and the full scans it makes when the watch loses track. Each subscriber
+ * has a seen-set of its own, checkpointed under its own key, and
+ * acknowledged by its own credit, so each is sent the names that are new
+ * to it.
+ *
+ * A subscriber may join a pump that has been running for some time. The
+ * names that arrive while it is linking are queued for it, and once it is
+ * linked it is caught up by a scan of its own (see client_catchup()).
+ * A subscriber that never links is dropped after PUMP_LINKWAIT.
+ *
+ * Backlog
+ * -------
+ *
+ * A subscriber that is out of credit, or not yet linked, cannot be waited
+ * for, so the names it has not been sent yet are queued on its client
+ * object, and go out as its credit comes in. The queue is not bounded; a
+ * subscriber that never reads will cost its backlog in memory until it
+ * hangs up.
+ *
+ ******************************************************************************/
+
+/*
+ * Client states
+ */
+#define C_LINK 0 // waiting for the subscriber's pid (see dpx_link())
+#define C_ACK  1 // sent ours, waiting for the ack
+#define C_RUN  2 // linked, sending names
+
+
+/*
+ * A name waiting on a subscriber's backlog
+ */
+struct name_t {
+        char *name;
+        uint64_t mtime;          // of the file, for lag_us (see stat_lag())
+};
+
+
+/*
+ * The client object datatype (PRIVATE)
+ */
+struct client_t {
+        int kind;                // EV_CLIENT
+        int state;               // C_LINK, C_ACK or C_RUN
+        struct dpx_t dpx;        // Channel to the subscriber
+        struct pump_t *pump;     // Pump it is subscribed to
+        struct client_t *next;   // Next subscriber of the same pump
+        struct seen_t *seen;     // Files already sent to the subscriber
+        long sent;               // Names put on the channel...
+        long acked;              // ...and acknowledged by the subscriber
+        uint64_t since;          // When it joined (monotonic usec)
+        bool broken;             // Its channel failed (see pumps_expire())
+        bool blocked;            // Its FIFO is full (see client_push())
+        struct name_t *backlog;  // Names waiting for credit (a ring)
+        size_t head;             // Next name to send
+        size_t tail;             // Next free slot
+        size_t cap;              // Slots in 'backlog'
+};
+
+#define PUMP_EVENTS   (64)    // epoll events handled per wakeup
+#define PUMP_LINKWAIT (10000) // msec a subscriber has to link
+
+
+/*
+ * Everything in the process. There is one loop, so these are only ever
+ * touched by it, and by the signal handler on the way out.
+ */
+static struct pump_t   *pumps;       // every live pump
+static struct pump_t   *dead_pumps;  // freed after this round of events
+static struct client_t *dead_clients;
+static struct dpx_t    *control;     // control channel
+static int  control_kind = EV_CONTROL;
+static int  epfd = -1;
+
+
+/**
+ * pumps_stat
+ * ``````````
+ * Write the figures of the daemon to the stat file.
+ *
+ * @mode  : P_KEEP or P_FORK
+ * @forked: number of pump processes forked so far
+ * Return : nothing.
+ *
+ * NOTE
+ * With P_FORK, every pump is a process of its own, which keeps its own
+ * counters, and the daemon holds none itself (see pump_files()).
+ */
+void pumps_stat(int mode, long forked)
+{
+        stat_dump(STAT_NAME, mode, forked);
+        stats_dirty = false;
+}
+
+
+/**
+ * pumps_name
+ * ``````````
+ * Make up the name of a channel for a new subscriber.
+ *
+ * @id    : destination of the name (PATHSIZE)
+ * @serial: number of the request, counted by the caller
+ * Return : nothing.
+ *
+ * NOTE
+ * A name made by tempname() only depends on the pid, so the daemon would
+ * hand every subscriber the same channel. Numbering them keeps them apart.
+ */
+void pumps_name(char *id, long serial)
+{
+        snprintf(id, PATHSIZE, "%d.%ld", (int)getpid(), serial);
+}
+
+
+/**
+ * ev_add
+ * ``````
+ * Wait on a file descriptor in the epoll loop.
+ *
+ * @fd   : the file descriptor
+ * @tag  : the pump, client or control tag it belongs to
+ * Return: nothing.
+ */
+static void ev_add(int fd, void *tag)
+{
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = tag };
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                bye("pumpd: Could not add descriptor to epoll");
+}
+
+
+/**
+ * ev_out
+ * ``````
+ * Wait on a file descriptor in the epoll loop until it can be written.
+ *
+ * @fd   : the file descriptor
+ * @tag  : the client tag it belongs to
+ * Return: nothing.
+ */
+static void ev_out(int fd, void *tag)
+{
+        struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = tag };
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                bye("pumpd: Could not add descriptor to epoll");
+}
+
+
+/**
+ * ev_del
+ * ``````
+ * Stop waiting on a file descriptor in the epoll loop.
+ *
+ * @fd   : the file descriptor
+ * Return: nothing.
+ */
+static void ev_del(int fd)
+{
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+
+/******************************************************************************
+ * Subscribers
+ ******************************************************************************/
+
+/**
+ * client_queue
+ * ````````````
+ * Put a name on the backlog of a subscriber.
+ *
+ * @c    : pointer to a client object
+ * @name : the name
+ * @mtime: mtime of the file
+ * Return: nothing.
+ */
+static void client_queue(struct client_t *c, const char *name, uint64_t mtime)
+{
+        struct name_t *ring;
+        struct name_t *b;
+        size_t n;
+        size_t i;
+
+        if (c->tail - c->head == c->cap) {
+                n = c->tail - c->head;
+
+                ring = calloc(c->cap ? c->cap * 2 : 64, sizeof(struct name_t));
+
+                if (!ring)
+                        bye("pumpd: Out of memory");
+
+                for (i=0; i<n; i++)
+                        ring[i] = c->backlog[(c->head + i) % c->cap];
+
+                free(c->backlog);
+
+                c->backlog = ring;
+                c->cap     = c->cap ? c->cap * 2 : 64;
+                c->head    = 0;
+                c->tail    = n;
+        }
+
+        b = &c->backlog[c->tail++ % c->cap];
+
+        if (!(b->name = strdup(name)))
+                bye("pumpd: Out of memory");
+
+        b->mtime = mtime;
+}
+
+
+/**
+ * client_send
+ * ```````````
+ * Send a name to a subscriber, or queue it if the subscriber is behind,
+ * or has not linked yet.
+ *
+ * @c    : pointer to a client object
+ * @name : the name
+ * @st   : stat of the file
+ * Return: nothing.
+ *
+ * NOTE
+ * This is called for every subscriber of a pump in turn, so a broken
+ * channel is only marked here, and the subscriber is dropped once the
+ * round of events is over (see pumps_expire()).
+ */
+static void client_send(struct client_t *c, const char *name,
+                        const struct stat *st)
+{
+        if (c->broken)
+                return;
+
+        if (c->state == C_RUN && c->head == c->tail && c->dpx.credit > 0) {
+                if (dpx_put(&c->dpx, name) == 0) {
+                        c->sent++;
+                        stats.sent++;
+                        stat_lag(usec_of(&st->st_mtim));
+                        return;
+                }
+                if (errno != EAGAIN) {
+                        c->broken = true;
+                        return;
+                }
+        }
+
+        client_queue(c, name, usec_of(&st->st_mtim));
+}
+
+
+/**
+ * client_push
+ * ```````````
+ * Write out whatever is batched for a subscriber.
+ *
+ * @c    : pointer to a linked client object
+ * Return: nothing.
+ *
+ * NOTE
+ * If the FIFO is full, the rest of the batch is left for later, and the
+ * loop is told to wake us when the FIFO can be written again; it calls
+ * client_event(), which pushes again. Once the batch is out, it stops.
+ */
+static void client_push(struct client_t *c)
+{
+        if (c->broken)
+                return;
+
+        if (dpx_push(&c->dpx) == -1) {
+                c->broken = true;
+                return;
+        }
+
+        if (c->dpx.outlen > 0 && !c->blocked)
+                ev_out(c->dpx.fd_pub, c);
+        else if (c->dpx.outlen == 0 && c->blocked)
+                ev_del(c->dpx.fd_pub);
+
+        c->blocked = (c->dpx.outlen > 0);
+}
+
+
+/**
+ * client_drain
+ * ````````````
+ * Send as much of the backlog of a subscriber as its credit allows.
+ *
+ * @c    : pointer to a linked client object
+ * Return: nothing.
+ */
+static void client_drain(struct client_t *c)
+{
+        struct name_t *b;
+
+        while (!c->broken && c->head < c->tail && c->dpx.credit > 0) {
+                b = &c->backlog[c->head % c->cap];
+
+                if (dpx_put(&c->dpx, b->name) == -1) {
+                        /* A full FIFO is not a broken one; try later */
+                        if (errno != EAGAIN)
+                                c->broken = true;
+                        break;
+                }
+
+                c->head++;
+                c->sent++;
+                stats.sent++;
+                stat_lag(b->mtime);
+                free(b->name);
+        }
+
+        client_push(c);
+}
+
+
+/**
+ * pump_del
+ * ````````
+ * Close a pump that nobody is subscribed to.
+ *
+ * @p    : pointer to a pump object with no clients
+ * Return: nothing.
+ */
+static void pump_del(struct pump_t *p)
+{
+        struct pump_t **pp;
+
+        for (pp=&pumps; *pp; pp=&(*pp)->next) {
+                if (*pp == p) {
+                        *pp = p->next;
+                        break;
+                }
+        }
+
+        if (!watch_polling(&p->watch))
+                ev_del(watch_fd(&p->watch));
+
+        pump_stop(p);
+
+        p->kind    = EV_DEAD;
+        p->next    = dead_pumps;
+        dead_pumps = p;
+
+        stats.pumps--;
+}
+
+
+/**
+ * client_del
+ * ``````````
+ * Hang up on a subscriber, and close its pump if it was the last one.
+ *
+ * @c    : pointer to a client object
+ * Return: nothing.
+ */
+static void client_del(struct client_t *c)
+{
+        struct client_t **cp;
+        struct pump_t *p = c->pump;
+
+        for (cp=&p->clients; *cp; cp=&(*cp)->next) {
+                if (*cp == c) {
+                        *cp = c->next;
+                        break;
+                }
+        }
+
+        ev_del(c->dpx.fd_sub);
+        if (c->blocked)
+                ev_del(c->dpx.fd_pub);
+        dpx_close(&c->dpx);
+        dpx_remove(c->dpx.path);
+
+        while (c->head < c->tail)
+                free(c->backlog[c->head++ % c->cap].name);
+        free(c->backlog);
+
+        /* What was not acknowledged stays out of the checkpoint */
+        seen_sync(c->seen);
+        seen_del(c->seen);
+
+        c->kind      = EV_DEAD;
+        c->next      = dead_clients;
+        dead_clients = c;
+
+        stats.clients--;
+
+        if (!p->clients)
+                pump_del(p);
+
+        pumps_stat(P_KEEP, 0);
+}
+
+
+/**
+ * pumps_reap
+ * ``````````
+ * Free the pumps and clients that were closed in this round of events.
+ *
+ * Return: nothing.
+ *
+ * NOTE
+ * An object closed by one event may still be the tag of a later one in
+ * the same round, so it is kept, marked EV_DEAD, until the round is over.
+ */
+static void pumps_reap(void)
+{
+        struct client_t *c;
+        struct pump_t *p;
+
+        while ((c = dead_clients)) {
+                dead_clients = c->next;
+                free(c->dpx.path);
+                free(c->dpx.path_pub);
+                free(c->dpx.path_sub);
+                free(c);
+        }
+
+        while ((p = dead_pumps)) {
+                dead_pumps = p->next;
+                free(p);
+        }
+}
+
+
+
+/******************************************************************************
+ * Pumps
+ ******************************************************************************/
+
+/**
+ * pump_send
+ * `````````
+ * Send a name to every subscriber of a pump that has not had it.
+ *
+ * @p    : pointer to a pump object
+ * @name : the name
+ * @st   : stat of the file
+ * Return: nothing.
+ *
+ * NOTE
+ * The file is counted as scanned once, however many subscribers there
+ * are, and as a seen-set hit if none of them needed it.
+ */
+static void pump_send(struct pump_t *p, const char *name, const struct stat *st)
+{
+        struct client_t *c;
+        bool sent = false;
+
+        stats.scanned++;
+
+        for (c=p->clients; c; c=c->next) {
+                if (seen_add(c->seen, st)) {
+                        client_send(c, name, st);
+                        sent = true;
+                }
+        }
+
+        if (!sent)
+                stats.seen_hits++;
+}
+
+
+/**
+ * pump_update
+ * ```````````
+ * Send whatever is new in the target directory of a pump.
+ *
+ * @p     : pointer to a pump object
+ * @status: what the watch said (see watch_wait())
+ * Return : nothing.
+ *
+ * NOTES
+ * This is the body of the loop in pump_files(), above, for a pump that
+ * cannot wait. The news goes to every subscriber, linked or not; those
+ * still linking have it queued (see client_send()).
+ */
+static void pump_update(struct pump_t *p, int status)
+{
+        const struct stat *st;
+        struct mark_t mark;
+        const char *file;
+        struct client_t *c;
+
+        stat_begin(&mark);
+
+        if (status == W_NAMES) {
+                while ((file = watch_next(&p->watch, F_REG)))
+                        pump_send(p, file, &p->watch.st);
+
+                /* Now and then, or the seen-sets only ever grow */
+                for (c=p->clients; c; c=c->next) {
+                        if (seen_stale(c->seen))
+                                status = W_RESCAN;
+                }
+        }
+
+        if (status == W_RESCAN) {
+                while ((file = diter_next(&p->iter))) {
+                        if ((st = diter_stat(&p->iter)))
+                                pump_send(p, file, st);
+                }
+
+                /* Forget files that are no longer there */
+                for (c=p->clients; c; c=c->next)
+                        seen_sweep(c->seen);
+        }
+
+        for (c=p->clients; c; c=c->next) {
+                if (c->state == C_RUN) {
+                        client_push(c);
+                        seen_sync(c->seen);
+                }
+        }
+
+        stat_end(&mark);
+}
+
+
+/**
+ * pump_get
+ * ````````
+ * Find the pump for a target directory, or open one.
+ *
+ * @target: the directory to be pumped
+ * Return : pointer to the pump, or NULL if the directory could not be
+ *          opened (see errno).
+ */
+static struct pump_t *pump_get(const char *target)
+{
+        struct pump_t *p;
+
+        for (p=pumps; p; p=p->next) {
+                if (STRCMP(p->target, target))
+                        return p;
+        }
+
+        p = new_pump((char *)target, "", "", P_KEEP);
+
+        if (!pump_start(p)) {
+                free(p);
+                return NULL;
+        }
+
+        if (!watch_polling(&p->watch))
+                ev_add(watch_fd(&p->watch), p);
+
+        p->next = pumps;
+        pumps   = p;
+        stats.pumps++;
+
+        return p;
+}
+
+
+/**
+ * pump_join
+ * `````````
+ * Open a channel for a new subscriber to a target directory.
+ *
+ * @target : the directory to be pumped
+ * @key    : names the checkpoint of the subscriber (see seen_open())
+ * @channel: the name of the channel to publish on
+ * Return  : false if the target or the checkpoint could not be opened
+ *           (see errno), in which case nothing is left behind, otherwise
+ *           true.
+ *
+ * NOTE
+ * The channel is ready when this returns, so the subscriber can be told
+ * its name straight away. It is opened last, since it is the one thing
+ * here that a bad request can not make fail.
+ */
+static bool pump_join(const char *target, const char *key, const char *channel)
+{
+        struct client_t *c;
+        int err;
+
+        if (!(c = calloc(1, sizeof(struct client_t))))
+                bye("pumpd: Out of memory");
+
+        c->kind  = EV_CLIENT;
+        c->state = C_LINK;
+        c->since = usec_now(CLOCK_MONOTONIC);
+
+        /* Pick up where this subscriber left off */
+        c->seen = seen_new(SEEN_MAX);
+
+        if (seen_open(c->seen, target, key) == -1
+         || !(c->pump = pump_get(target))) {
+                err = errno;
+                seen_del(c->seen);
+                free(c);
+                errno = err;
+                return false;
+        }
+
+        dpx_open(&c->dpx, CHANNEL(channel), CH_NEW | CH_PUB | CH_NIO);
+
+        c->next       = c->pump->clients;
+        c->pump->clients = c;
+        stats.clients++;
+
+        ev_add(c->dpx.fd_sub, c);
+
+        return true;
+}
+
+
+/**
+ * client_catchup
+ * ``````````````
+ * Send a newly linked subscriber everything in the directory it has not had.
+ *
+ * @c    : pointer to a client object that has just linked
+ * Return: nothing.
+ *
+ * NOTE
+ * The pump may have been running for a long time before this subscriber
+ * came along, and the watch only tells us what is new, so the directory
+ * is scanned for this subscriber alone. Names queued while it was linking
+ * go out first; its seen-set keeps it from having any of them twice.
+ */
+static void client_catchup(struct client_t *c)
+{
+        const struct stat *st;
+        struct mark_t mark;
+        const char *file;
+
+        stat_begin(&mark);
+
+        while ((file = diter_next(&c->pump->iter))) {
+                if ((st = diter_stat(&c->pump->iter)) && stat_seen(c->seen, st))
+                        client_send(c, file, st);
+        }
+
+        /* Forget files that are no longer there */
+        seen_sweep(c->seen);
+
+        client_drain(c);
+        seen_sync(c->seen);
+
+        stat_end(&mark);
+}
+
+
+/**
+ * client_event
+ * ````````````
+ * Handle whatever a subscriber has sent, or the room it has made.
+ *
+ * @c    : pointer to a client object
+ * Return: nothing.
+ *
+ * NOTES
+ * The publisher's half of dpx_link(), one step per event. Once the pid
+ * is in, the subscriber has its end of the channel open, so the keepalive
+ * is dropped and a hangup reads as one in any state after that. From the
+ * ack on, the subscriber only ever sends credit, and there may be nothing
+ * to read at all if the event was for a FIFO that can be written again.
+ */
+static void client_event(struct client_t *c)
+{
+        char pid[32];
+
+        switch (c->state) {
+        case C_LINK:
+                switch (dpx_tryread(&c->dpx)) {
+                case -1:
+                        return;
+                case 0:
+                        client_del(c);
+                        return;
+                }
+
+                c->dpx.remote_pid = atoi(c->dpx.buf);
+                dpx_unkeep(&c->dpx);
+
+                snprintf(pid, sizeof(pid), "%d", getpid());
+
+                if (dpx_trysend(&c->dpx, pid) == -1) {
+                        client_del(c);
+                        return;
+                }
+                c->state = C_ACK;
+                break;
+
+        case C_ACK:
+                switch (dpx_tryread(&c->dpx)) {
+                case -1:
+                        return;
+                case 0:
+                        client_del(c);
+                        return;
+                }
+
+                c->state = C_RUN;
+                client_catchup(c);
+                break;
+
+        case C_RUN:
+                switch (dpx_credit(&c->dpx)) {
+                case FR_NONE:
+                case FR_ERROR:
+                        client_del(c);
+                        break;
+                default:
+                        stat_ack(&c->dpx, c->seen, c->sent, &c->acked);
+                        client_drain(c);
+                        seen_sync(c->seen);
+                        break;
+                }
+                break;
+        }
+}
+
+
+/**
+ * pumps_reply
+ * ```````````
+ * Answer a request on the control channel.
+ *
+ * @msg  : the name of the subscriber's channel, or a PUMP_REFUSED reply
+ * Return: nothing.
+ *
+ * CAVEAT
+ * The control channel is opened O_RDWR, so a reply that nobody reads,
+ * say because the subscriber died after asking, stays in the FIFO. Once
+ * the FIFO is full of those, the oldest is read back out to make room.
+ * If that was in fact a subscriber still on its way, it will never hear
+ * back, and its client object is dropped after PUMP_LINKWAIT.
+ */
+static void pumps_reply(const char *msg)
+{
+        char stale[MIN_PIPESIZE];
+
+        while (dpx_trysend(control, msg) == -1) {
+                if (errno != EAGAIN)
+                        return;
+                if (read(control->fd_pub, stale, MIN_PIPESIZE) <= 0)
+                        return;
+        }
+}
+
+
+/**
+ * pumps_request
+ * `````````````
+ * Answer the requests that have arrived on the control channel.
+ *
+ * Return: nothing.
+ *
+ * NOTE
+ * A request that can not be served, say for a directory that is not
+ * there, is answered with PUMP_REFUSED and the reason, instead of the
+ * name of a channel. Only the one subscriber is turned away.
+ */
+static void pumps_request(void)
+{
+        static long serial;
+        char target[PATHSIZE];
+        char key[SEEN_KEY+1];
+        char id[PATHSIZE];
+        char reply[MIN_PIPESIZE];
+
+        while (dpx_tryread(control) == 1) {
+                if (control->buf[0] == '\0')
+                        continue;
+
+                pump_parse(control->buf, target, key);
+
+                /* Make up a name, make the channel, and say where it is */
+                pumps_name(id, ++serial);
+
+                if (pump_join(target, key, id)) {
+                        pumps_reply(id);
+                } else {
+                        snprintf(reply, MIN_PIPESIZE, "%c%s: %s",
+                                 PUMP_REFUSED, target, strerror(errno));
+                        pumps_reply(reply);
+                }
+
+                pumps_stat(P_KEEP, 0);
+        }
+}
+
+
+/**
+ * pumps_timeout
+ * `````````````
+ * Work out how long the loop may sleep.
+ *
+ * Return: the shortest polling interval of any pump that polls, or time
+ *         until a watch owes a rescan or a subscriber must have linked,
+ *         in milliseconds, or -1 (forever) if there is none of these.
+ *
+ * NOTE
+ * If the counters have changed, the loop wakes up in time to write them
+ * out, at most STAT_INTERVAL after they were last written.
+ */
+static int pumps_timeout(void)
+{
+        struct pump_t *p;
+        struct client_t *c;
+        uint64_t now = usec_now(CLOCK_MONOTONIC);
+        long wait = -1;
+        long left;
+
+        for (p=pumps; p; p=p->next) {
+                left = watch_polling(&p->watch) ? p->watch.wait : -1;
+
+                if (left != -1 && (wait == -1 || left < wait))
+                        wait = left;
+
+                /* A watch may owe us a rescan (see watch.c) */
+                left = watch_due(&p->watch);
+
+                if (left != -1 && (wait == -1 || left < wait))
+                        wait = left;
+
+                /* A subscriber may run out of time to link */
+                for (c=p->clients; c; c=c->next) {
+                        if (c->state != C_LINK)
+                                continue;
+
+                        left = PUMP_LINKWAIT - (long)((now - c->since) / 1000);
+                        left = (left < 0) ? 0 : left;
+
+                        if (wait == -1 || left < wait)
+                                wait = left;
+                }
+        }
+
+        if (stats_dirty && (wait == -1 || stat_due() < wait))
+                wait = stat_due();
+
+        return (int)wait;
+}
+
+
+/**
+ * pumps_poll
+ * ``````````
+ * Check the directories that cannot be watched, and those whose watch
+ * owes a rescan that has come due.
+ *
+ * Return: the number of directories checked.
+ */
+static int pumps_poll(void)
+{
+        struct pump_t *p;
+        struct pump_t *next;
+        int polled = 0;
+        int status;
+
+        for (p=pumps; p; p=next) {
+                next = p->next;
+
+                if (!watch_polling(&p->watch) && watch_due(&p->watch) != 0)
+                        continue;
+
+                polled++;
+
+                /* The directory is gone; so are its subscribers */
+                if ((status = watch_check(&p->watch)) == W_ERROR) {
+                        while (p->clients)
+                                client_del(p->clients);
+                        continue;
+                }
+
+                if (status != W_NONE)
+                        pump_update(p, status);
+        }
+
+        return polled;
+}
+
+
+
+/**
+ * pumps_expire
+ * ````````````
+ * Drop the subscribers that were given a channel and never linked to it,
+ * and those whose channel broke in this round of events.
+ *
+ * Return: nothing.
+ *
+ * NOTE
+ * Until the subscriber has sent its pid, we hold the keepalive on our own
+ * end of the channel (see dpx_unkeep()), so a subscriber that dies before
+ * then can not be seen to hang up. It is given PUMP_LINKWAIT instead.
+ */
+static void pumps_expire(void)
+{
+        struct pump_t *p;
+        struct pump_t *next;
+        struct client_t *c;
+        struct client_t *c_next;
+        uint64_t now  = usec_now(CLOCK_MONOTONIC);
+        uint64_t wait = (uint64_t)PUMP_LINKWAIT * 1000; // in usec, as 'now'
+
+        for (p=pumps; p; p=next) {
+                next = p->next; // client_del() may close the pump
+
+                for (c=p->clients; c; c=c_next) {
+                        c_next = c->next;
+
+                        if (c->broken)
+                                client_del(c);
+                        else if (c->state == C_LINK && now - c->since >= wait)
+                                client_del(c);
+                }
+        }
+}
+
+
+
+/******************************************************************************
+ * PUBLIC
+ ******************************************************************************/
+
+/**
+ * pumps_run
+ * `````````
+ * Serve every pump and every subscriber of the daemon from one loop.
+ *
+ * @dpx  : the control channel, opened CH_NEW | CH_PUB | CH_NIO
+ * Return: does not return.
+ */
+void pumps_run(struct dpx_t *dpx)
+{
+        struct epoll_event ev[PUMP_EVENTS];
+        struct pump_t *p;
+        uint64_t sent;
+        int status;
+        int n;
+        int i;
+
+        if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+                bye("pumpd: Could not create epoll instance");
+
+        control = dpx;
+
+        register_pump(NULL);
+        ev_add(control->fd_sub, &control_kind);
+        pumps_stat(P_KEEP, 0);
+
+        for (;;) {
+                n = epoll_wait(epfd, ev, PUMP_EVENTS, pumps_timeout());
+
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        bye("pumpd: Could not wait for events");
+                }
+
+                sent = stats.sent;
+
+                for (i=0; i<n; i++) {
+                        switch (*(int *)ev[i].data.ptr) {
+                        case EV_CONTROL:
+                                pumps_request();
+                                break;
+
+                        case EV_PUMP:
+                                p = ev[i].data.ptr;
+
+                                /* Fall back to polling if the watch breaks */
+                                status = watch_wait(&p->watch);
+
+                                if (status == W_ERROR) {
+                                        ev_del(watch_fd(&p->watch));
+                                        watch_close(&p->watch);
+                                        status = W_RESCAN;
+                                }
+
+                                pump_update(p, status);
+                                break;
+
+                        case EV_CLIENT:
+                                client_event(ev[i].data.ptr);
+                                break;
+                        }
+                }
+
+                /* Waking up only to write the counters doesn't count */
+                if (pumps_poll() > 0 || n > 0) {
+                        stats.wakeups++;
+                        stats.idle += (stats.sent == sent);
+                        stats_dirty = true;
+                }
+
+                pumps_expire();
+                pumps_reap();
+
+                if (stats_dirty && stat_due() == 0)
+                        pumps_stat(P_KEEP, 0);
+        }
+}
+
+
+/**
+ * pumps_kill
+ * ``````````
+ * Hang up on every subscriber and close every pump in the process.
+ *
+ * Return: nothing.
+ */
+void pumps_kill(void)
+{
+        while (pumps) {
+                while (pumps->clients)
+                        client_del(pumps->clients);
+        }
+}
@@ -1,15 +1,24 @@
 #ifndef _PUMPS_H
 #define _PUMPS_H
 
-struct pump_t *__pump_fwr;
+struct dpx_t;
 
 #define P_FORK 1
 #define P_KEEP 0
 
-struct pump_t *new_pump(char *target, char *channel, int mode);
+#define PUMP_REFUSED '!' // leads a control reply that is an error, not a channel
+
+struct pump_t *new_pump(char *target, char *key, char *channel, int mode);
+void          pump_parse(const char *msg, char *target, char *key);
 void          open_pump(struct pump_t *p);
 void          kill_pump(struct pump_t *p);
 void         pump_files(struct pump_t *p);
-void          pump_idle(struct pump_t *p, long nanoseconds);
+int           pump_idle(struct pump_t *p);
+long          pump_wait(const char *target);
+
+void          pumps_run(struct dpx_t *control);
+void         pumps_kill(void);
+void         pumps_stat(int mode, long forked);
+void         pumps_name(char *id, long serial);
 
 #endif
@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <signal.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "eo.h"
 #include "meta.h"
@@ -20,54 +21,497 @@
 #include "regex.h"
 
 
+/******************************************************************************
+ * GLOB PATTERNS
+ *
+ * A pattern is compiled once, when the statement is parsed, and matched
+ * against every filename after that. The syntax is that of the shell:
+ *
+ *      *       any run of characters, including none
+ *      ?       any one character
+ *      [...]   any one of the characters in the brackets, which may
+ *              include ranges (a-z), and which is negated by a leading
+ *              ! or ^. A ] right after the [ (or the !) is literal.
+ *      \c      the character c, literally
+ *
+ * Fast paths
+ * ----------
+ *
+ * Nearly all patterns in practice are a literal with a star at one end or
+ * both, e.g. "*.jpg", "IMG_*" or "*_thumb*". Compiling sorts patterns into
+ * kinds (PAT_SUFFIX, etc.), so that these are one memcmp() or memmem() of
+ * the literal. Everything else is PAT_GLOB, which first checks the literal
+ * prefix and suffix of the pattern, and then runs the matcher below.
+ *
+ * The matcher
+ * -----------
+ *
+ * The matcher is iterative. When it meets a star it remembers where, and
+ * when a later character fails to match, it backs up and lets the last
+ * star take one more character. Only the last star ever needs to be
+ * revisited, so matching takes at most O(len(pattern) * len(string)).
+ * Where the element after a star is a literal character, the string is
+ * scanned for it with memchr() rather than one character at a time.
+ *
+ ******************************************************************************/
+
+/**
+ * pat_class
+ * `````````
+ * Match a character against a bracket expression.
+ *
+ * @p    : pattern, at the '['
+ * @c    : the character
+ * @end  : destination of the pattern after the closing ']'
+ * Return: 1 if it matches, 0 if not, -1 if the bracket is never closed.
+ */
+static int pat_class(const char *p, unsigned char c, const char **end)
+{
+        bool negate = false;
+        bool match  = false;
+        unsigned char lo;
+        unsigned char hi;
+
+        p++;
+
+        if (*p == '!' || *p == '^') {
+                negate = true;
+                p++;
+        }
+
+        /* A ']' straight away is a member, not the end */
+        do {
+                if (*p == '\0')
+                        return -1;
+
+                if (*p == '\\' && p[1] != '\0')
+                        p++;
+
+                lo = hi = (unsigned char)*p++;
+
+                if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+                        p++;
+                        if (*p == '\\' && p[1] != '\0')
+                                p++;
+                        hi = (unsigned char)*p++;
+                }
+
+                if (lo <= c && c <= hi)
+                        match = true;
+
+        } while (*p != ']');
+
+        *end = p + 1;
+
+        return (match != negate) ? 1 : 0;
+}
+
+
+/**
+ * pat_one
+ * ```````
+ * Match a character against the next element of a pattern (not a star).
+ *
+ * @p    : pattern
+ * @c    : the character
+ * Return: length of the element if it matches, otherwise 0.
+ */
+static inline size_t pat_one(const char *p, unsigned char c)
+{
+        const char *end;
+
+        switch (*p) {
+        case '\0':
+                return 0;
+        case '?':
+                return 1;
+        case '[':
+                switch (pat_class(p, c, &end)) {
+                case 1:
+                        return end - p;
+                case 0:
+                        return 0;
+                }
+                break; /* never closed, so a literal '[' */
+        case '\\':
+                if (p[1] != '\0')
+                        return ((unsigned char)p[1] == c) ? 2 : 0;
+                break;
+        }
+
+        return ((unsigned char)*p == c) ? 1 : 0;
+}
+
+
+/**
+ * pat_seek
+ * ````````
+ * Find the first place in a string the element after a star could match.
+ *
+ * @p    : pattern, after the star
+ * @s    : string
+ * @end  : end of the string
+ * Return: pointer into the string, or NULL if there is no such place.
+ */
+static inline const char *pat_seek(const char *p, const char *s, const char *end)
+{
+        if (*p == '\\' && p[1] != '\0')
+                p++;
+        else if (*p == '?' || *p == '[')
+                return s;
+
+        return memchr(s, *p, end - s);
+}
+
+
+/**
+ * pat_glob
+ * ````````
+ * Match a string against a pattern.
+ *
+ * @p    : pattern
+ * @s    : string
+ * @end  : end of the string
+ * Return: true if it matches, otherwise false.
+ */
+static bool pat_glob(const char *p, const char *s, const char *end)
+{
+        const char *sp = NULL; // pattern after the last star
+        const char *ss = NULL; // where the match after the last star starts
+        size_t n;
+
+        while (s < end) {
+                if (*p == '*') {
+                        while (*p == '*')
+                                p++;
+                        if (*p == '\0')
+                                return true;
+                        if (!(s = pat_seek(p, s, end)))
+                                return false;
+                        sp = p;
+                        ss = s;
+                        continue;
+                }
+
+                if ((n = pat_one(p, *s))) {
+                        p += n;
+                        s++;
+                        continue;
+                }
+
+                /* Mismatch; let the last star take one more character */
+                if (!sp || !(s = pat_seek(sp, ss + 1, end)))
+                        return false;
+                p  = sp;
+                ss = s;
+        }
+
+        while (*p == '*')
+                p++;
+
+        return *p == '\0';
+}
+
+
+/**
+ * pat_compile
+ * ```````````
+ * Compile a glob pattern.
+ *
+ * @pat  : destination of the compiled pattern
+ * @src  : the pattern
+ * Return: nothing.
+ */
+void pat_compile(struct pat_t *pat, const char *src)
+{
+        const char *p;
+        const char *end;
+        size_t stars = 0;
+
+        memset(pat, 0, offsetof(struct pat_t, lit));
+
+        pat->len = slcpy(pat->src, src, PATHSIZE);
+        pat->lit[0] = '\0';
+
+        if (pat->len >= PATHSIZE)
+                pat->len = PATHSIZE - 1;
+
+        /* Literal prefix and suffix */
+        while (pat->pre < pat->len && !strchr("*?[\\", pat->src[pat->pre]))
+                pat->pre++;
+
+        while (pat->suf < pat->len && !strchr("*?[]\\", pat->src[pat->len - pat->suf - 1]))
+                pat->suf++;
+
+        /* Count the elements that match a character each */
+        for (p = pat->src; *p; ) {
+                if (*p == '*') {
+                        stars++;
+                        p++;
+                } else if (*p == '[' && pat_class(p, 0, &end) != -1) {
+                        pat->min++;
+                        p = end;
+                } else if (*p == '\\' && p[1] != '\0') {
+                        pat->min++;
+                        p += 2;
+                } else {
+                        pat->min++;
+                        p++;
+                }
+        }
+
+        /* Sort it into a kind */
+        if (pat->len > 0 && stars == pat->len) {
+                pat->kind = PAT_ANY;
+        } else if (pat->pre == pat->len) {
+                pat->kind = PAT_EXACT;
+        } else if (pat->pre > 0 && pat->pre + stars == pat->len
+                               && strspn(pat->src + pat->pre, "*") == stars) {
+                pat->kind = PAT_PREFIX;
+        } else if (pat->suf > 0 && pat->suf + stars == pat->len
+                               && strspn(pat->src, "*") == stars) {
+                pat->kind = PAT_SUFFIX;
+        } else if (stars >= 2 && pat->min + stars == pat->len
+                               && pat->src[0] == '*' && pat->src[pat->len-1] == '*'
+                               && strcspn(pat->src + strspn(pat->src, "*"), "*?[\\") == pat->min) {
+                pat->kind = PAT_INFIX;
+                slcpy(pat->lit, pat->src + strspn(pat->src, "*"), pat->min + 1);
+        } else {
+                pat->kind = PAT_GLOB;
+        }
+}
+
+
+/**
+ * pat_matchn
+ * ``````````
+ * Match a string of known length against a compiled pattern.
+ *
+ * @pat  : compiled pattern
+ * @str  : string to be tested (NUL-terminated)
+ * @len  : length of the string
+ * Return: true if it matches, otherwise false.
+ */
+bool pat_matchn(const struct pat_t *pat, const char *str, size_t len)
+{
+        if (len < pat->min)
+                return false;
+
+        switch (pat->kind) {
+        case PAT_ANY:
+                return true;
+        case PAT_EXACT:
+                return len == pat->len && !memcmp(str, pat->src, len);
+        case PAT_PREFIX:
+                return !memcmp(str, pat->src, pat->pre);
+        case PAT_SUFFIX:
+                return !memcmp(str + len - pat->suf, pat->src + pat->len - pat->suf, pat->suf);
+        case PAT_INFIX:
+                return memmem(str, pat->lit) != NULL;
+        }
+
+        if (memcmp(str, pat->src, pat->pre))
+                return false;
+        if (memcmp(str + len - pat->suf, pat->src + pat->len - pat->suf, pat->suf))
+                return false;
+
+        return pat_glob(pat->src + pat->pre, str + pat->pre, str + len);
+}
+
+
+/**
+ * pat_match
+ * `````````
+ * Match a string against a compiled pattern.
+ *
+ * @pat  : compiled pattern
+ * @str  : string to be tested
+ * Return: true if it matches, otherwise false.
+ */
+bool pat_match(const struct pat_t *pat, const char *str)
+{
+        return pat_matchn(pat, str, strlen(str));
+}
+
+
 /**
  * kleene
  * ``````
- * Tests whether a string conforms to a pattern containing Kleene stars.
+ * Tests whether a string conforms to a glob pattern.
  *
  * @pattern: the pattern to be matched
  * @string : the string to be tested
- * Return  : 1 if match, 0 if not match, -1 if bad pattern, -2 if bad string. 
+ * Return  : 1 if match, 0 if not match.
+ *
+ * NOTE
+ * This compiles the pattern every time. Anything that matches the same
+ * pattern more than once should keep a compiled pattern (pat_compile).
  */
 int kleene(const char *pat, const char *str)
 {
-        top:
-
-        /* Seek and check non-star characters */
-        while (*pat != '*') {
-                if (*str == *pat) {
-                        str++;
-                        pat++;
-                        if (*pat == '\0') {
-                                goto out;
-                        }
-                } else {
-                        goto out;
-                }
+        struct pat_t compiled;
+
+        pat_compile(&compiled, pat);
+
+        return pat_match(&compiled, str) ? 1 : 0;
+}
+
+
+
+/******************************************************************************
+ * PATTERN SETS
+ *
+ * A pattern set matches one filename against many patterns at once, as
+ * when one pump serves many routines, each with a filter of its own.
+ *
+ * Rather than try every pattern, the set indexes them by a byte that any
+ * match must have: the last byte of the name, if the pattern ends with a
+ * literal, or else the first byte, if it begins with one. A name is only
+ * tried against the patterns indexed under its own last and first bytes,
+ * and the few patterns (like "*") that could not be indexed. With the
+ * usual mix of extensions and prefixes, that is a handful of memcmp()s
+ * no matter how many patterns there are.
+ *
+ ******************************************************************************/
+
+/**
+ * patlist_add
+ * ```````````
+ * Append an id to a list.
+ *
+ * @list : pointer to a list
+ * @id   : id to append
+ * Return: nothing.
+ */
+static void patlist_add(struct patlist_t *list, int id)
+{
+        if (list->n == list->cap) {
+                list->cap = (list->cap) ? list->cap * 2 : 4;
+                if (!(list->id = realloc(list->id, list->cap * sizeof(int))))
+                        bye("patset: Out of memory");
         }
+        list->id[list->n++] = id;
+}
 
-        /* Move the cursor to the character after
-         * the asterisk, the "stop" character where
-         * wildcard matching will halt. */
-        if (*pat == '*') pat++;
 
-        /* Move the string cursor until it reaches
-         * the delimiter, or reaches the NUL. */
-        while (*str != *pat) {
-                if (*str == '\0') {
-                        goto out;
-                } else {
-                        str++;
-                }
+/**
+ * patset_new
+ * ``````````
+ * Allocate an empty pattern set.
+ *
+ * Return: pointer to a pattern set.
+ */
+struct patset_t *patset_new(void)
+{
+        struct patset_t *set;
+
+        if (!(set = calloc(1, sizeof(struct patset_t))))
+                bye("patset: Out of memory");
+
+        return set;
+}
+
+
+/**
+ * patset_del
+ * ``````````
+ * Free a pattern set.
+ *
+ * @set  : pointer to a pattern set
+ * Return: nothing.
+ */
+void patset_del(struct patset_t *set)
+{
+        int i;
+
+        for (i=0; i<256; i++) {
+                free(set->last[i].id);
+                free(set->first[i].id);
+        }
+        free(set->rest.id);
+        free(set->pat);
+        free(set);
+}
+
+
+/**
+ * patset_add
+ * ``````````
+ * Compile a pattern into a set.
+ *
+ * @set  : pointer to a pattern set
+ * @src  : the pattern
+ * Return: id of the pattern in the set (ids count up from 0).
+ */
+int patset_add(struct patset_t *set, const char *src)
+{
+        struct pat_t *pat;
+        int id;
+
+        if (set->n == set->cap) {
+                set->cap = (set->cap) ? set->cap * 2 : 8;
+                if (!(set->pat = realloc(set->pat, set->cap * sizeof(struct pat_t))))
+                        bye("patset: Out of memory");
         }
 
-        goto top;
+        id  = set->n++;
+        pat = &set->pat[id];
+
+        pat_compile(pat, src);
 
-        out:
-        return (*str == *pat) ? 1 : 0;
+        if (pat->suf > 0)
+                patlist_add(&set->last[(unsigned char)pat->src[pat->len-1]], id);
+        else if (pat->pre > 0)
+                patlist_add(&set->first[(unsigned char)pat->src[0]], id);
+        else
+                patlist_add(&set->rest, id);
+
+        return id;
 }
 
 
+/**
+ * patset_match
+ * ````````````
+ * Match a string against every pattern in a set.
+ *
+ * @set  : pointer to a pattern set
+ * @str  : string to be tested
+ * @ids  : destination of the ids of the matching patterns
+ * @max  : number of slots in 'ids'
+ * Return: number of matching patterns (which may be more than 'max').
+ *
+ * NOTE
+ * The ids are not in any particular order.
+ */
+int patset_match(struct patset_t *set, const char *str, int *ids, int max)
+{
+        struct patlist_t *lists[3];
+        size_t len = strlen(str);
+        int count = 0;
+        int i;
+        int j;
+
+        lists[0] = &set->rest;
+        lists[1] = (len) ? &set->last[(unsigned char)str[len-1]] : NULL;
+        lists[2] = (len) ? &set->first[(unsigned char)str[0]]    : NULL;
+
+        for (i=0; i<3; i++) {
+                if (!lists[i])
+                        continue;
+
+                for (j=0; j<lists[i]->n; j++) {
+                        if (pat_matchn(&set->pat[lists[i]->id[j]], str, len)) {
+                                if (count < max)
+                                        ids[count] = lists[i]->id[j];
+                                count++;
+                        }
+                }
+        }
+
+        return count;
+}
+
 
 
 void globber(struct glob_t *glob, const char *str, int argc, char **argv) 
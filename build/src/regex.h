@@ -2,6 +2,58 @@
 #define _GLOB_H
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common/io/file.h"
+
+
+/* Compiled patterns
+``````````````````````````````````````````````````````````````````````````````*/
+#define PAT_ANY    0 // "*"
+#define PAT_EXACT  1 // "name.jpg"
+#define PAT_PREFIX 2 // "IMG_*"
+#define PAT_SUFFIX 3 // "*.jpg"
+#define PAT_INFIX  4 // "*_thumb*"
+#define PAT_GLOB   5 // anything else
+
+struct pat_t {
+        int    kind;              // one of the above
+        size_t len;               // length of the pattern
+        size_t pre;               // bytes of literal prefix
+        size_t suf;               // bytes of literal suffix
+        size_t min;               // shortest string that can match
+        char   lit[PATHSIZE];     // the literal, for PAT_INFIX
+        char   src[PATHSIZE];     // the pattern
+};
+
+void pat_compile(struct pat_t *pat, const char *src);
+bool pat_match  (const struct pat_t *pat, const char *str);
+bool pat_matchn (const struct pat_t *pat, const char *str, size_t len);
+
+
+/* Pattern sets
+``````````````````````````````````````````````````````````````````````````````*/
+struct patlist_t {
+        int *id;
+        int  n;
+        int  cap;
+};
+
+struct patset_t {
+        struct pat_t *pat;            // patterns, by id
+        int n;
+        int cap;
+        struct patlist_t last[256];   // ids, by the last byte they require
+        struct patlist_t first[256];  // ...or else the first byte
+        struct patlist_t rest;        // ...or else neither
+};
+
+struct patset_t *patset_new  (void);
+void             patset_del  (struct patset_t *set);
+int              patset_add  (struct patset_t *set, const char *src);
+int              patset_match(struct patset_t *set, const char *str, int *ids, int max);
+
 
 struct glob_t {
         int n;